@@ -0,0 +1,115 @@
+// arena.c
+#include "arena.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#define PAGINA_GRANDE (2UL << 20)
+
+static size_t tamPagina(const Arena *a) {
+    return a->hugepages ? PAGINA_GRANDE : (size_t)sysconf(_SC_PAGESIZE);
+}
+
+// Mapeo anonimo (alineado a pagina, y por tanto a 64); con hugepages prueba
+// primero paginas grandes reservadas y si no pide THP con madvise
+static void *mapear(const Arena *a, size_t tam) {
+    void *p = MAP_FAILED;
+#ifdef MAP_HUGETLB
+    if (a->hugepages) p = mmap(NULL, tam, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+#endif
+    if (p == MAP_FAILED) {
+        p = mmap(NULL, tam, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (p == MAP_FAILED) return NULL;
+#ifdef MADV_HUGEPAGE
+        if (a->hugepages) madvise(p, tam, MADV_HUGEPAGE);
+#endif
+    }
+    return p;
+}
+
+void iniciarArena(Arena *a, int hugepages) {
+    memset(a, 0, sizeof(*a));
+    a->hugepages = hugepages;
+}
+
+void *pedirBuffer(Arena *a, size_t tam) {
+    if (tam == 0) tam = 1;
+    if (!a) return aligned_alloc(ALINEACION_ARENA, (tam + ALINEACION_ARENA - 1) & ~(size_t)(ALINEACION_ARENA - 1));
+    a->pedidos++;
+
+    // El libre mas chico que alcance; si ninguno alcanza, el libre mas grande
+    // se agranda para no acumular buffers
+    BufferArena *mejor = NULL, *mayor = NULL;
+    for (int i = 0; i < a->n; i++) {
+        BufferArena *b = &a->buffers[i];
+        if (b->enUso) continue;
+        if (b->capacidad >= tam && (!mejor || b->capacidad < mejor->capacidad)) mejor = b;
+        if (!mayor || b->capacidad > mayor->capacidad) mayor = b;
+    }
+
+    if (mejor) {
+        a->aciertos++;
+        size_t reutilizado = tam < mejor->tocado ? tam : mejor->tocado;
+        a->fallosEvitados += reutilizado / tamPagina(a);
+        if (tam > mejor->tocado) mejor->tocado = tam;
+        mejor->enUso = 1;
+        return mejor->datos;
+    }
+
+    BufferArena *b = mayor;
+    if (!b && a->n < MAX_BUFFERS_ARENA) b = &a->buffers[a->n++];
+    if (!b) return aligned_alloc(ALINEACION_ARENA, (tam + ALINEACION_ARENA - 1) & ~(size_t)(ALINEACION_ARENA - 1));
+
+    if (b->datos) {
+        munmap(b->datos, b->capacidad);
+        a->capacidadTotal -= b->capacidad;
+    }
+    size_t pagina = tamPagina(a);
+    size_t capacidad = (tam + pagina - 1) / pagina * pagina;
+    b->datos = mapear(a, capacidad);
+    b->capacidad = b->datos ? capacidad : 0;
+    b->tocado = b->datos ? tam : 0;
+    b->enUso = b->datos != NULL;
+    a->capacidadTotal += b->capacidad;
+    if (a->capacidadTotal > a->pico) a->pico = a->capacidadTotal;
+    a->crecimientos++;
+    return b->datos;
+}
+
+void devolverBuffer(Arena *a, void *p) {
+    if (!p) return;
+    if (a) {
+        for (int i = 0; i < a->n; i++) {
+            if (a->buffers[i].datos == p) {
+                a->buffers[i].enUso = 0;
+                return;
+            }
+        }
+    }
+    free(p);
+}
+
+void recortarArena(Arena *a, size_t limite) {
+    while (a->capacidadTotal > limite) {
+        BufferArena *mayor = NULL;
+        for (int i = 0; i < a->n; i++) {
+            BufferArena *b = &a->buffers[i];
+            if (!b->enUso && b->datos && (!mayor || b->capacidad > mayor->capacidad)) mayor = b;
+        }
+        if (!mayor) return;
+        munmap(mayor->datos, mayor->capacidad);
+        a->capacidadTotal -= mayor->capacidad;
+        mayor->datos = NULL;
+        mayor->capacidad = mayor->tocado = 0;
+    }
+}
+
+void liberarArena(Arena *a) {
+    for (int i = 0; i < a->n; i++) {
+        if (a->buffers[i].datos) munmap(a->buffers[i].datos, a->buffers[i].capacidad);
+    }
+    a->n = 0;
+    a->capacidadTotal = 0;
+}
@@ -0,0 +1,43 @@
+// arena.h
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+// Pool de buffers de trabajo de un rank, reutilizados entre imagenes. Los
+// buffers solo crecen (quedan del tamano de la imagen mas grande vista) y
+// sus paginas ya estan mapeadas, asi que reutilizarlos evita los fallos de
+// pagina de un malloc nuevo. No es seguro entre hilos: se pide y devuelve
+// fuera de las regiones paralelas.
+#define MAX_BUFFERS_ARENA 16
+#define ALINEACION_ARENA 64
+
+typedef struct {
+    void *datos;
+    size_t capacidad;  // bytes mapeados
+    size_t tocado;     // bytes ya escritos alguna vez (paginas residentes)
+    int enUso;
+} BufferArena;
+
+typedef struct {
+    BufferArena buffers[MAX_BUFFERS_ARENA];
+    int n;
+    int hugepages;              // mapear con paginas de 2 MB si el sistema las da
+    unsigned long pedidos;
+    unsigned long aciertos;     // servidos por un buffer libre suficiente
+    unsigned long crecimientos; // buffers creados o agrandados
+    unsigned long long fallosEvitados; // paginas ya residentes entregadas de nuevo
+    size_t capacidadTotal;
+    size_t pico;                // maximo de capacidadTotal
+} Arena;
+
+void iniciarArena(Arena *a, int hugepages);
+// Buffer de al menos tam bytes alineado a ALINEACION_ARENA. Con a NULL
+// equivale a aligned_alloc y devolverBuffer a free.
+void *pedirBuffer(Arena *a, size_t tam);
+void devolverBuffer(Arena *a, void *p);
+// Libera buffers libres hasta que la capacidad total no supere limite
+void recortarArena(Arena *a, size_t limite);
+void liberarArena(Arena *a);
+
+#endif // ARENA_H
@@ -0,0 +1,290 @@
+// bench.c
+// Filter benchmark on synthetic in-memory BMPs: no disk, NFS or MPI in the
+// measurement. Reports median time, MPix/s and GB/s per filter, size, kernel
+// and thread count, and can save a baseline and compare a later run with it.
+#include "image_processing.h"
+#include <omp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX_LISTA 16
+#define MAX_RESULTADOS 1024
+
+typedef enum {
+    FILTRO_PLANO_GRISES,
+    FILTRO_GRIS,
+    FILTRO_HG,
+    FILTRO_VG,
+    FILTRO_HC,
+    FILTRO_VC,
+    FILTRO_BLUR_INTEGRAL,
+    FILTRO_BLUR_SEPARABLE,
+    FILTRO_GAUSS,
+    NUM_FILTROS
+} Filtro;
+
+static const char *nombresFiltros[NUM_FILTROS] = {
+    "plano_grises", "gris", "hg", "vg", "hc", "vc", "blur_integral", "blur_separable", "gauss"
+};
+
+typedef struct {
+    char clave[96];        // filter/WxH/kK/tT, the key used in baselines
+    double mediana;        // seconds
+    double mpixs, gbs;
+} Resultado;
+
+// 24-bit bottom-up BMP in a heap buffer: gradients plus xorshift noise so
+// the grayscale and blur kernels see realistic, non-constant data
+static int generarImagen(int ancho, int alto, uint32_t semilla, ImagenBMP *img) {
+    memset(img, 0, sizeof(*img));
+    img->padding   = (4 - (ancho * 3) % 4) % 4;
+    img->rowSize   = (size_t)ancho * 3 + img->padding;
+    img->imageSize = img->rowSize * alto;
+
+    img->header.type   = 0x4D42;
+    img->header.offset = sizeof(BMPHeader) + sizeof(DIBHeader);
+    img->header.size   = (uint32_t)(img->header.offset + img->imageSize);
+    img->dib.size         = sizeof(DIBHeader);
+    img->dib.width        = ancho;
+    img->dib.height       = alto;
+    img->dib.planes       = 1;
+    img->dib.bitsPerPixel = 24;
+    img->dib.imageSize    = (uint32_t)img->imageSize;
+
+    uint8_t *p = malloc(img->imageSize);
+    if (!p) return -1;
+    uint32_t x = semilla ? semilla : 1;
+    for (int y = 0; y < alto; y++) {
+        uint8_t *fila = p + (size_t)y * img->rowSize;
+        for (int c = 0; c < ancho; c++) {
+            x ^= x << 13; x ^= x >> 17; x ^= x << 5;
+            fila[c * 3 + 0] = (uint8_t)(c * 255 / (ancho > 1 ? ancho - 1 : 1) + (x & 15));
+            fila[c * 3 + 1] = (uint8_t)(y * 255 / (alto > 1 ? alto - 1 : 1) + ((x >> 8) & 15));
+            fila[c * 3 + 2] = (uint8_t)(x >> 24);
+        }
+        memset(fila + (size_t)ancho * 3, 0, img->padding);
+    }
+    img->pixeles = p;
+    return 0;
+}
+
+// Bytes one call reads from the input and writes to its output
+static double bytesFiltro(Filtro f, const ImagenBMP *img) {
+    double pixeles = (double)img->dib.width * img->dib.height;
+    if (f == FILTRO_PLANO_GRISES) return img->imageSize + pixeles;
+    if (f == FILTRO_GAUSS) return 2.0 * PASADAS_GAUSS * img->imageSize;
+    return 2.0 * img->imageSize;
+}
+
+static int ejecutarFiltro(Filtro f, const ImagenBMP *img, uint8_t *salida, int kernelSize, Arena *arena) {
+    switch (f) {
+    case FILTRO_PLANO_GRISES:   calcularGrises(img, salida); return 0;
+    case FILTRO_GRIS:           convertirGrisesBGR(img, salida, 0, 0); return 0;
+    case FILTRO_HG:             convertirGrisesBGR(img, salida, 1, 0); return 0;
+    case FILTRO_VG:             convertirGrisesBGR(img, salida, 0, 1); return 0;
+    case FILTRO_HC:             espejoHorizontalColor(img, salida); return 0;
+    case FILTRO_VC:             espejoVerticalColor(img, salida); return 0;
+    case FILTRO_BLUR_INTEGRAL:  return desenfoqueIntegral(img, salida, kernelSize, arena);
+    case FILTRO_BLUR_SEPARABLE: return desenfoqueSeparable(img, salida, kernelSize, arena);
+    case FILTRO_GAUSS:          return desenfoqueGaussiano(img, salida, sigmaGauss(kernelSize), arena);
+    default:                    return -1;
+    }
+}
+
+static int compararDouble(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+// One warm-up call, then the median of reps timed calls
+static double medirFiltro(Filtro f, const ImagenBMP *img, uint8_t *salida, int kernelSize, int reps, Arena *arena) {
+    double *tiempos = malloc(reps * sizeof(double));
+    if (!tiempos || ejecutarFiltro(f, img, salida, kernelSize, arena) != 0) {
+        free(tiempos);
+        return -1.0;
+    }
+    for (int r = 0; r < reps; r++) {
+        double t0 = omp_get_wtime();
+        ejecutarFiltro(f, img, salida, kernelSize, arena);
+        tiempos[r] = omp_get_wtime() - t0;
+    }
+    qsort(tiempos, reps, sizeof(double), compararDouble);
+    double mediana = reps % 2 ? tiempos[reps / 2] : 0.5 * (tiempos[reps / 2 - 1] + tiempos[reps / 2]);
+    free(tiempos);
+    return mediana;
+}
+
+// "a,b,c" -> up to MAX_LISTA positive ints
+static int parsearLista(const char *s, int *lista) {
+    int n = 0;
+    while (*s && n < MAX_LISTA) {
+        char *fin;
+        long v = strtol(s, &fin, 10);
+        if (fin == s) break;
+        if (v > 0) lista[n++] = (int)v;
+        s = *fin == ',' ? fin + 1 : fin;
+    }
+    return n;
+}
+
+// "WxH,WxH" -> up to MAX_LISTA sizes
+static int parsearTamanos(const char *s, int *anchos, int *altos) {
+    int n = 0;
+    while (*s && n < MAX_LISTA) {
+        int w, h, leidos = 0;
+        if (sscanf(s, "%dx%d%n", &w, &h, &leidos) != 2) break;
+        if (w > 0 && h > 0) {
+            anchos[n] = w;
+            altos[n] = h;
+            n++;
+        }
+        s += leidos;
+        if (*s == ',') s++;
+    }
+    return n;
+}
+
+static int guardarBaseline(const char *ruta, const Resultado *res, int n) {
+    FILE *f = fopen(ruta, "w");
+    if (!f) return -1;
+    fprintf(f, "# clave mediana_s mpix_s gb_s\n");
+    for (int i = 0; i < n; i++) fprintf(f, "%s %.9f %.3f %.3f\n", res[i].clave, res[i].mediana, res[i].mpixs, res[i].gbs);
+    fclose(f);
+    return 0;
+}
+
+// Compares every key present in both runs; returns how many got slower by
+// more than umbral percent
+static int compararBaseline(const char *ruta, const Resultado *res, int n, double umbral) {
+    FILE *f = fopen(ruta, "r");
+    if (!f) {
+        fprintf(stderr, "No se pudo abrir la baseline %s\n", ruta);
+        return -1;
+    }
+    int regresiones = 0, comparados = 0;
+    char linea[256], clave[96];
+    double mediana;
+    printf("\n%-40s %12s %12s %9s\n", "comparacion", "base ms", "actual ms", "cambio");
+    while (fgets(linea, sizeof(linea), f)) {
+        if (linea[0] == '#' || sscanf(linea, "%95s %lf", clave, &mediana) != 2) continue;
+        for (int i = 0; i < n; i++) {
+            if (strcmp(res[i].clave, clave) != 0 || mediana <= 0) continue;
+            double cambio = (res[i].mediana / mediana - 1.0) * 100.0;
+            int regresion = cambio > umbral;
+            regresiones += regresion;
+            comparados++;
+            printf("%-40s %12.3f %12.3f %+8.1f%%%s\n", clave, mediana * 1e3, res[i].mediana * 1e3, cambio,
+                   regresion ? "  REGRESION" : "");
+        }
+    }
+    fclose(f);
+    printf("%d comparados, %d regresiones (umbral %.1f%%)\n", comparados, regresiones, umbral);
+    return regresiones;
+}
+
+int main(int argc, char *argv[]) {
+    // --------- Argument parsing ---------
+    // Odd widths by default so the row padding paths are exercised
+    int anchos[MAX_LISTA] = { 1920, 1023 }, altos[MAX_LISTA] = { 1080, 767 }, numTamanos = 2;
+    int kernels[MAX_LISTA] = { 3, 55, 155 }, numKernels = 3;
+    int hilos[MAX_LISTA] = { omp_get_max_threads() }, numHilos = 1;
+    int reps = 5;
+    double umbral = 10.0;           // percent slower that counts as a regression
+    const char *guardar = NULL, *comparar = NULL;
+
+    for (int a = 1; a < argc; a++) {
+        if (strncmp(argv[a], "--tamanos=", 10) == 0) {
+            numTamanos = parsearTamanos(argv[a] + 10, anchos, altos);
+        } else if (strncmp(argv[a], "--kernels=", 10) == 0) {
+            numKernels = parsearLista(argv[a] + 10, kernels);
+        } else if (strncmp(argv[a], "--hilos=", 8) == 0) {
+            numHilos = parsearLista(argv[a] + 8, hilos);
+        } else if (strncmp(argv[a], "--reps=", 7) == 0) {
+            reps = atoi(argv[a] + 7);
+        } else if (strncmp(argv[a], "--guardar=", 10) == 0) {
+            guardar = argv[a] + 10;
+        } else if (strncmp(argv[a], "--comparar=", 11) == 0) {
+            comparar = argv[a] + 11;
+        } else if (strncmp(argv[a], "--umbral=", 9) == 0) {
+            umbral = atof(argv[a] + 9);
+        } else if (strcmp(argv[a], "--verificar-grises") == 0) {
+            // Exhaustive accuracy check instead of timing
+            return verificarGrises(stdout) == 0 ? 0 : 1;
+        } else {
+            fprintf(stderr, "Uso: %s [--tamanos=WxH,...] [--kernels=k,...] [--hilos=n,...] [--reps=N]\n"
+                            "       [--guardar=archivo] [--comparar=archivo] [--umbral=porcentaje]\n"
+                            "       %s --verificar-grises\n", argv[0], argv[0]);
+            return 1;
+        }
+    }
+    if (numTamanos == 0 || numKernels == 0 || numHilos == 0 || reps < 1) {
+        fprintf(stderr, "Listas vacias o --reps menor a 1\n");
+        return 1;
+    }
+
+    // --------- Benchmark loop ---------
+    static Resultado resultados[MAX_RESULTADOS];
+    int numResultados = 0;
+    Arena arena;
+    iniciarArena(&arena, 0);
+
+    printf("%-16s %11s %5s %5s %12s %10s %8s\n", "filtro", "tamano", "k", "hilos", "mediana ms", "MPix/s", "GB/s");
+    for (int t = 0; t < numTamanos; t++) {
+        ImagenBMP img;
+        if (generarImagen(anchos[t], altos[t], 12345u + t, &img) != 0) {
+            fprintf(stderr, "Sin memoria para %dx%d\n", anchos[t], altos[t]);
+            continue;
+        }
+        uint8_t *salida = malloc(img.imageSize);
+        if (!salida) {
+            free((void *)img.pixeles);
+            continue;
+        }
+        double pixeles = (double)anchos[t] * altos[t];
+
+        for (int h = 0; h < numHilos; h++) {
+            omp_set_num_threads(hilos[h]);
+            for (int f = 0; f < NUM_FILTROS; f++) {
+                int esBlur = f == FILTRO_BLUR_INTEGRAL || f == FILTRO_BLUR_SEPARABLE || f == FILTRO_GAUSS;
+                for (int k = 0; k < (esBlur ? numKernels : 1); k++) {
+                    int kernelSize = esBlur ? kernels[k] : 0;
+                    double mediana = medirFiltro(f, &img, salida, kernelSize, reps, &arena);
+                    if (mediana < 0) {
+                        fprintf(stderr, "Fallo %s en %dx%d\n", nombresFiltros[f], anchos[t], altos[t]);
+                        continue;
+                    }
+                    double mpixs = mediana > 0 ? pixeles / 1e6 / mediana : 0;
+                    double gbs = mediana > 0 ? bytesFiltro(f, &img) / (1024.0 * 1024.0 * 1024.0) / mediana : 0;
+                    char tamano[32];
+                    snprintf(tamano, sizeof(tamano), "%dx%d", anchos[t], altos[t]);
+                    printf("%-16s %11s %5d %5d %12.3f %10.1f %8.2f\n", nombresFiltros[f], tamano, kernelSize,
+                           hilos[h], mediana * 1e3, mpixs, gbs);
+
+                    if (numResultados < MAX_RESULTADOS) {
+                        Resultado *r = &resultados[numResultados++];
+                        snprintf(r->clave, sizeof(r->clave), "%s/%s/k%d/t%d", nombresFiltros[f], tamano,
+                                 kernelSize, hilos[h]);
+                        r->mediana = mediana;
+                        r->mpixs = mpixs;
+                        r->gbs = gbs;
+                    }
+                }
+            }
+        }
+        free(salida);
+        free((void *)img.pixeles);
+    }
+    liberarArena(&arena);
+
+    if (guardar && guardarBaseline(guardar, resultados, numResultados) != 0) {
+        fprintf(stderr, "No se pudo escribir la baseline %s\n", guardar);
+        return 1;
+    }
+    if (comparar) {
+        int regresiones = compararBaseline(comparar, resultados, numResultados, umbral);
+        if (regresiones < 0) return 1;
+        if (regresiones > 0) return 2;
+    }
+    return 0;
+}
@@ -0,0 +1,288 @@
+// cache.c
+#define _GNU_SOURCE // copy_file_range
+#include "cache.h"
+#include <dirent.h>
+#include <fcntl.h>
+#include <linux/fs.h>
+#include <omp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// --------- Hash ---------
+
+// Cuatro carriles independientes de multiplicar y rotar sobre palabras de
+// 64 bits (al estilo de xxHash64): unos 4 bytes por ciclo por hilo, muy por
+// debajo de lo que cuesta leer la imagen para cualquier filtro
+#define PRIMO1 0x9E3779B185EBCA87ULL
+#define PRIMO2 0xC2B2AE3D27D4EB4FULL
+#define PRIMO3 0x165667B19E3779F9ULL
+
+static inline uint64_t rotar(uint64_t x, int r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t ronda(uint64_t acc, uint64_t x) {
+    acc += x * PRIMO2;
+    return rotar(acc, 31) * PRIMO1;
+}
+
+static inline uint64_t avalancha(uint64_t h) {
+    h ^= h >> 33;
+    h *= PRIMO2;
+    h ^= h >> 29;
+    h *= PRIMO3;
+    h ^= h >> 32;
+    return h;
+}
+
+static void hashBloque(const uint8_t *p, size_t n, uint64_t out[2]) {
+    uint64_t v[4] = { PRIMO1 + PRIMO2, PRIMO2, 0, -PRIMO1 };
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        uint64_t w[4];
+        memcpy(w, p + i, 32);
+        for (int l = 0; l < 4; l++) v[l] = ronda(v[l], w[l]);
+    }
+    uint64_t cola[4] = { 0 };
+    memcpy(cola, p + i, n - i);
+    for (int l = 0; l < 4; l++) v[l] = ronda(v[l], cola[l]);
+
+    // Dos resumenes distintos de los cuatro carriles: 128 bits por bloque
+    uint64_t a = rotar(v[0], 1) + rotar(v[1], 7) + rotar(v[2], 12) + rotar(v[3], 18);
+    uint64_t b = ronda(ronda(ronda(ronda(n, v[3]), v[2]), v[1]), v[0]);
+    out[0] = avalancha(a ^ n);
+    out[1] = avalancha(b + PRIMO3);
+}
+
+int hashArchivo(Cache *c, const char *ruta, int hilos, HashContenido *hash) {
+    double t0 = omp_get_wtime();
+    int fd = open(ruta, O_RDONLY);
+    if (fd < 0) return -1;
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return -1;
+    }
+    size_t tam = (size_t)st.st_size;
+    hash->bytes = st.st_size;
+    hash->h[0] = PRIMO1 ^ tam;
+    hash->h[1] = PRIMO2 ^ tam;
+    if (tam == 0) {
+        close(fd);
+        return 0;
+    }
+
+    const uint8_t *mapa = mmap(NULL, tam, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapa == MAP_FAILED) return -1;
+    madvise((void *)mapa, tam, MADV_SEQUENTIAL);
+
+    size_t nb = (tam + BLOQUE_HASH - 1) / BLOQUE_HASH;
+    uint64_t *bloques = malloc(nb * 2 * sizeof(uint64_t));
+    if (!bloques) {
+        munmap((void *)mapa, tam);
+        return -1;
+    }
+    #pragma omp parallel for num_threads(hilos > 0 ? hilos : 1) schedule(static)
+    for (size_t b = 0; b < nb; b++) {
+        size_t off = b * BLOQUE_HASH;
+        hashBloque(mapa + off, tam - off < BLOQUE_HASH ? tam - off : BLOQUE_HASH, &bloques[2 * b]);
+    }
+    for (size_t b = 0; b < nb; b++) {
+        hash->h[0] = avalancha(ronda(hash->h[0], bloques[2 * b]) + b);
+        hash->h[1] = avalancha(ronda(hash->h[1], bloques[2 * b + 1]) ^ b);
+    }
+    free(bloques);
+    munmap((void *)mapa, tam);
+
+    if (c) {
+        c->bytesHash += tam;
+        c->segundosHash += omp_get_wtime() - t0;
+    }
+    return 0;
+}
+
+// --------- Entradas ---------
+
+int abrirCache(Cache *c, const char *dir, long long limite) {
+    memset(c, 0, sizeof(*c));
+    snprintf(c->dir, sizeof(c->dir), "%s", dir);
+    c->limite = limite;
+    mkdir(dir, 0777);
+    char uso[1024];
+    snprintf(uso, sizeof(uso), "%s/%s", dir, DIR_USO_CACHE);
+    mkdir(uso, 0777);
+    return access(dir, R_OK | W_OK | X_OK) == 0 && access(uso, W_OK) == 0 ? 0 : -1;
+}
+
+static void nombreEntrada(const HashContenido *hash, const char *etiqueta, char *nombre, size_t tam) {
+    snprintf(nombre, tam, "%016llx%016llx-%llx_%s", (unsigned long long)hash->h[0],
+             (unsigned long long)hash->h[1], (unsigned long long)hash->bytes, etiqueta);
+}
+
+static void rutaEntrada(const Cache *c, const HashContenido *hash, const char *etiqueta, char *ruta, size_t tam) {
+    char nombre[256];
+    nombreEntrada(hash, etiqueta, nombre, sizeof(nombre));
+    snprintf(ruta, tam, "%s/%s", c->dir, nombre);
+}
+
+static void rutaUso(const Cache *c, const char *nombre, char *ruta, size_t tam) {
+    snprintf(ruta, tam, "%s/%s/%s", c->dir, DIR_USO_CACHE, nombre);
+}
+
+// Ultimo uso de la entrada: el mtime de su archivo en DIR_USO_CACHE, nunca
+// el de la entrada, que puede estar enlazada como salida de un usuario
+static void marcarUso(const Cache *c, const HashContenido *hash, const char *etiqueta) {
+    char nombre[256], ruta[1024];
+    nombreEntrada(hash, etiqueta, nombre, sizeof(nombre));
+    rutaUso(c, nombre, ruta, sizeof(ruta));
+    int fd = open(ruta, O_WRONLY | O_CREAT, 0644);
+    if (fd < 0) return;
+    futimens(fd, NULL);
+    close(fd);
+}
+
+int enCache(const Cache *c, const HashContenido *hash, const char *etiqueta) {
+    char ruta[1024];
+    rutaEntrada(c, hash, etiqueta, ruta, sizeof(ruta));
+    return access(ruta, R_OK) == 0;
+}
+
+// Copia origen en destino (que no existe): reflink si el sistema de
+// archivos lo permite, si no copy_file_range y por ultimo read/write
+static int copiarArchivo(const char *origen, const char *destino) {
+    int in = open(origen, O_RDONLY);
+    if (in < 0) return -1;
+    int out = open(destino, O_WRONLY | O_CREAT | O_EXCL, 0644);
+    if (out < 0) {
+        close(in);
+        return -1;
+    }
+    int error = 0;
+    if (ioctl(out, FICLONE, in) != 0) {
+        struct stat st;
+        error = fstat(in, &st) != 0;
+        off_t resto = error ? 0 : st.st_size;
+        while (resto > 0) {
+            ssize_t n = copy_file_range(in, NULL, out, NULL, (size_t)resto, 0);
+            if (n <= 0) break;
+            resto -= n;
+        }
+        char buffer[1 << 16];
+        while (!error && resto > 0) {
+            ssize_t n = read(in, buffer, sizeof(buffer));
+            if (n <= 0 || write(out, buffer, (size_t)n) != n) error = 1;
+            else resto -= n;
+        }
+    }
+    close(in);
+    if (close(out) != 0) error = 1;
+    if (error) unlink(destino);
+    return error ? -1 : 0;
+}
+
+// Pone en destino el contenido de origen sin exponerlo a medias: enlace duro
+// o copia a un temporal del mismo directorio y rename
+static int enlazarOCopiar(const char *origen, const char *destino, int *enlazado) {
+    char tmp[1100];
+    snprintf(tmp, sizeof(tmp), "%s.tmp.%d", destino, (int)getpid());
+    unlink(tmp);
+    *enlazado = link(origen, tmp) == 0;
+    if (!*enlazado && copiarArchivo(origen, tmp) != 0) return -1;
+    if (rename(tmp, destino) != 0) {
+        unlink(tmp);
+        return -1;
+    }
+    return 0;
+}
+
+int servirDeCache(Cache *c, const HashContenido *hash, const char *etiqueta, const char *ruta) {
+    char entrada[1024];
+    rutaEntrada(c, hash, etiqueta, entrada, sizeof(entrada));
+    struct stat st;
+    int enlazado;
+    if (stat(entrada, &st) != 0 || enlazarOCopiar(entrada, ruta, &enlazado) != 0) return -1;
+    marcarUso(c, hash, etiqueta);
+    c->aciertos++;
+    c->enlazadas += enlazado;
+    c->bytesServidos += st.st_size;
+    return 0;
+}
+
+int guardarEnCache(Cache *c, const HashContenido *hash, const char *etiqueta, const char *ruta) {
+    char entrada[1024];
+    rutaEntrada(c, hash, etiqueta, entrada, sizeof(entrada));
+    int enlazado;
+    struct stat st;
+    if (stat(ruta, &st) != 0 || enlazarOCopiar(ruta, entrada, &enlazado) != 0) return -1;
+    marcarUso(c, hash, etiqueta);
+    c->guardadas++;
+    c->total += st.st_size;
+    if (c->limite > 0 && c->total > c->limite) recortarCacheHasta(c, (long long)(c->limite * FRACCION_RECORTE_CACHE));
+    return 0;
+}
+
+// --------- Recorte LRU ---------
+
+typedef struct {
+    char nombre[256];
+    time_t uso;
+    long long bytes;
+} EntradaCache;
+
+static int compararUso(const void *a, const void *b) {
+    time_t ua = ((const EntradaCache *)a)->uso, ub = ((const EntradaCache *)b)->uso;
+    return (ua > ub) - (ua < ub);
+}
+
+void recortarCache(Cache *c) {
+    recortarCacheHasta(c, c->limite);
+}
+
+void recortarCacheHasta(Cache *c, long long hasta) {
+    if (c->limite <= 0) return;
+    DIR *dir = opendir(c->dir);
+    if (!dir) return;
+
+    EntradaCache *entradas = NULL;
+    int n = 0, capacidad = 0;
+    long long total = 0;
+    struct dirent *d;
+    char ruta[1024];
+    while ((d = readdir(dir)) != NULL) {
+        if (d->d_name[0] == '.' || strstr(d->d_name, ".tmp.")) continue;
+        snprintf(ruta, sizeof(ruta), "%s/%s", c->dir, d->d_name);
+        struct stat st;
+        if (stat(ruta, &st) != 0 || !S_ISREG(st.st_mode) || strlen(d->d_name) >= sizeof(entradas->nombre)) continue;
+        if (n == capacidad) {
+            capacidad = capacidad ? 2 * capacidad : 256;
+            EntradaCache *nuevas = realloc(entradas, capacidad * sizeof(EntradaCache));
+            if (!nuevas) break;
+            entradas = nuevas;
+        }
+        strcpy(entradas[n].nombre, d->d_name);
+        entradas[n].bytes = st.st_size;
+        entradas[n].uso = st.st_mtime; // entradas anteriores a los archivos de uso
+        char uso[1024];
+        rutaUso(c, d->d_name, uso, sizeof(uso));
+        if (stat(uso, &st) == 0) entradas[n].uso = st.st_mtime;
+        total += st.st_size;
+        n++;
+    }
+    closedir(dir);
+
+    qsort(entradas, n, sizeof(EntradaCache), compararUso);
+    for (int i = 0; i < n && total > hasta; i++) {
+        snprintf(ruta, sizeof(ruta), "%s/%s", c->dir, entradas[i].nombre);
+        if (unlink(ruta) == 0) total -= entradas[i].bytes;
+        rutaUso(c, entradas[i].nombre, ruta, sizeof(ruta));
+        unlink(ruta);
+    }
+    free(entradas);
+    c->total = total;
+}
@@ -0,0 +1,71 @@
+// cache.h
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Cache de resultados direccionada por contenido: cada salida se guarda en
+// el directorio de la cache con el hash de los bytes de la entrada y una
+// etiqueta con las opciones que cambian la salida (describirOpcionesSalida).
+// Una imagen identica con otro nombre se sirve enlazando o copiando las
+// entradas en vez de recalcular sus filtros.
+//
+// Las entradas son archivos "<hash>_<etiqueta>". Una entrada puede ser un
+// enlace duro de la salida de un usuario, asi que el ultimo uso no se marca
+// en ella sino en un archivo vacio con el mismo nombre en DIR_USO_CACHE;
+// recortarCache borra las menos usadas hasta entrar en el limite.
+// Varios ranks del mismo nodo pueden compartir el directorio: las entradas
+// se escriben con otro nombre y se renombran, asi nunca se ve una a medias,
+// y una entrada borrada mientras otro rank la sirve solo le cuesta un fallo.
+
+// Bytes de cada bloque del hash; fijo para que el resultado no dependa de
+// cuantos hilos lo calculan
+#define BLOQUE_HASH (1 << 20)
+#define MAX_ETIQUETA_CACHE 96
+#define DIR_USO_CACHE "uso"
+// Al pasar el limite se recorta hasta esta fraccion de el, asi no se
+// recorre el directorio con cada entrada nueva
+#define FRACCION_RECORTE_CACHE 0.9
+
+typedef struct {
+    uint64_t h[2];
+    long long bytes;       // tamano de la entrada, parte de la clave
+} HashContenido;
+
+typedef struct {
+    char dir[512];
+    long long limite;      // bytes; 0 = sin limite
+    long long total;       // bytes en el directorio segun el ultimo recorte mas lo guardado desde entonces
+    // Contadores de este rank, por salida
+    unsigned long long aciertos, fallos, guardadas;
+    unsigned long long enlazadas; // aciertos servidos con un enlace duro
+    unsigned long long bytesServidos, bytesHash;
+    double segundosHash;
+} Cache;
+
+// Crea el directorio si hace falta; -1 si no se puede usar
+int abrirCache(Cache *c, const char *dir, long long limite);
+
+// Hash de 128 bits del archivo completo, por bloques de BLOQUE_HASH en
+// paralelo con hilos hilos
+int hashArchivo(Cache *c, const char *ruta, int hilos, HashContenido *hash);
+
+// 1 si la cache tiene la salida de esa etiqueta para ese hash
+int enCache(const Cache *c, const HashContenido *hash, const char *etiqueta);
+// Deja en ruta la salida guardada (enlace duro, reflink o copia, en ese
+// orden de preferencia); 0 si se pudo
+int servirDeCache(Cache *c, const HashContenido *hash, const char *etiqueta, const char *ruta);
+// Guarda la salida recien escrita en ruta; 0 si se pudo. Si con ella el
+// total pasa el limite, recorta en ese momento y no al final de la corrida.
+int guardarEnCache(Cache *c, const HashContenido *hash, const char *etiqueta, const char *ruta);
+
+// Borra las entradas menos usadas hasta que el total no supere hasta (en
+// bytes) y deja en c->total lo que queda. Cada rank cuenta solo lo que el
+// guardo, asi que varios ranks en un directorio pueden pasarse del limite
+// hasta que el proximo recorte lo vea entero.
+void recortarCacheHasta(Cache *c, long long hasta);
+// recortarCacheHasta(c, c->limite)
+void recortarCache(Cache *c);
+
+#endif // CACHE_H
@@ -0,0 +1,237 @@
+// contadores.c
+#include "contadores.h"
+#include <errno.h>
+#include <linux/perf_event.h>
+#include <omp.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+static int abrirEvento(int evento) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    switch (evento) {
+    case EVENTO_INSTRUCCIONES: attr.config = PERF_COUNT_HW_INSTRUCTIONS; break;
+    case EVENTO_CICLOS:        attr.config = PERF_COUNT_HW_CPU_CYCLES; break;
+    case EVENTO_FALLOS_CACHE:  attr.config = PERF_COUNT_HW_CACHE_MISSES; break;
+    default:
+        attr.type = PERF_TYPE_HW_CACHE;
+        attr.config = PERF_COUNT_HW_CACHE_LL | (PERF_COUNT_HW_CACHE_OP_READ << 8)
+                    | (PERF_COUNT_HW_CACHE_RESULT_ACCESS << 16);
+        break;
+    }
+    // Solo espacio de usuario: es lo que permite perf_event_paranoid <= 2
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    return (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+// Suma de un evento en todos los hilos, escalada si el kernel lo multiplexo
+static unsigned long long leerEvento(const Contadores *c, int evento) {
+    unsigned long long total = 0;
+    for (int t = 0; t < c->hilos; t++) {
+        uint64_t v[3];
+        if (read(c->fds[t][evento], v, sizeof(v)) != sizeof(v)) continue;
+        total += v[2] > 0 && v[2] < v[1] ? (unsigned long long)((double)v[0] * v[1] / v[2]) : v[0];
+    }
+    return total;
+}
+
+// Lee /proc/<tarea>/io; -1 si no existe (sin procfs o kernel sin
+// CONFIG_TASK_IO_ACCOUNTING)
+static int leerES(const char *ruta, unsigned long long es[NUM_ES]) {
+    static const char *const campos[NUM_ES] = { "rchar", "wchar", "read_bytes", "write_bytes" };
+    FILE *f = fopen(ruta, "r");
+    if (!f) return -1;
+    int leidos = 0;
+    char nombre[32];
+    unsigned long long valor;
+    while (fscanf(f, "%31[^:]: %llu\n", nombre, &valor) == 2) {
+        for (int i = 0; i < NUM_ES; i++) {
+            if (strcmp(nombre, campos[i]) == 0) {
+                es[i] = valor;
+                leidos++;
+            }
+        }
+    }
+    fclose(f);
+    return leidos == NUM_ES ? 0 : -1;
+}
+
+static void inicioEtapa(void *ctx) {
+    Contadores *c = ctx;
+    for (int e = 0; e < NUM_EVENTOS; e++) {
+        if (c->disponibles[e]) c->inicio[e] = leerEvento(c, e);
+    }
+    if (c->conES && leerES("/proc/thread-self/io", c->esInicio) != 0) c->conES = 0;
+    c->tInicio = omp_get_wtime();
+}
+
+static void finEtapa(void *ctx, int etapa, size_t leidos, size_t escritos, size_t pixeles) {
+    Contadores *c = ctx;
+    MedidaEtapa *m = &c->etapas[etapa];
+    m->segundos += omp_get_wtime() - c->tInicio;
+    for (int e = 0; e < NUM_EVENTOS; e++) {
+        if (c->disponibles[e]) m->eventos[e] += leerEvento(c, e) - c->inicio[e];
+    }
+    unsigned long long es[NUM_ES];
+    if (c->conES && leerES("/proc/thread-self/io", es) == 0) {
+        m->esLeidos += es[ES_LEIDOS] - c->esInicio[ES_LEIDOS];
+        m->esEscritos += es[ES_ESCRITOS] - c->esInicio[ES_ESCRITOS];
+    }
+    m->leidos += leidos;
+    m->escritos += escritos;
+    m->pixeles += pixeles;
+    m->llamadas++;
+}
+
+void iniciarContadores(Contadores *c) {
+    memset(c, 0, sizeof(*c));
+    c->hilos = omp_get_max_threads();
+    c->fds = malloc(c->hilos * sizeof(*c->fds));
+    if (!c->fds) {
+        c->hilos = 0;
+        c->error = ENOMEM;
+    } else {
+        for (int e = 0; e < NUM_EVENTOS; e++) c->disponibles[e] = 1;
+        // Cada hilo abre sus propios contadores (pid 0 = el hilo llamador)
+        #pragma omp parallel num_threads(c->hilos)
+        {
+            int t = omp_get_thread_num();
+            for (int e = 0; e < NUM_EVENTOS; e++) {
+                c->fds[t][e] = abrirEvento(e);
+                if (c->fds[t][e] < 0) {
+                    #pragma omp critical
+                    {
+                        c->disponibles[e] = 0;
+                        if (e == EVENTO_INSTRUCCIONES && !c->error) c->error = errno;
+                    }
+                }
+            }
+        }
+    }
+
+    unsigned long long es[NUM_ES];
+    c->conES = leerES("/proc/self/io", c->esLote) == 0 && leerES("/proc/thread-self/io", es) == 0;
+
+    MedidorEtapas m = { inicioEtapa, finEtapa, c };
+    agregarMedidorEtapas(&m);
+}
+
+void terminarContadores(Contadores *c) {
+    quitarMedidorEtapas(c);
+    unsigned long long es[NUM_ES];
+    if (c->conES && leerES("/proc/self/io", es) == 0) {
+        for (int i = 0; i < NUM_ES; i++) c->esLote[i] = es[i] - c->esLote[i];
+    } else {
+        c->conES = 0;
+    }
+    for (int t = 0; t < c->hilos; t++) {
+        for (int e = 0; e < NUM_EVENTOS; e++) {
+            if (c->fds[t][e] >= 0) close(c->fds[t][e]);
+        }
+    }
+    free(c->fds);
+    c->fds = NULL;
+    c->hilos = 0;
+}
+
+void reducirContadores(const Contadores *c, MedidaEtapa total[NUM_ETAPAS], int disponibles[NUM_EVENTOS],
+                       int *error, unsigned long long es[NUM_ES], int *conES, MPI_Comm comm) {
+    // Enteros y segundos por separado: NUM_EVENTOS + 6 contadores por etapa
+    enum { CAMPOS = NUM_EVENTOS + 6 };
+    unsigned long long local[NUM_ETAPAS * CAMPOS], suma[NUM_ETAPAS * CAMPOS];
+    double segundos[NUM_ETAPAS], sumaSegundos[NUM_ETAPAS];
+    for (int s = 0; s < NUM_ETAPAS; s++) {
+        const MedidaEtapa *m = &c->etapas[s];
+        unsigned long long *l = &local[s * CAMPOS];
+        memcpy(l, m->eventos, sizeof(m->eventos));
+        l[NUM_EVENTOS + 0] = m->leidos;
+        l[NUM_EVENTOS + 1] = m->escritos;
+        l[NUM_EVENTOS + 2] = m->pixeles;
+        l[NUM_EVENTOS + 3] = m->llamadas;
+        l[NUM_EVENTOS + 4] = m->esLeidos;
+        l[NUM_EVENTOS + 5] = m->esEscritos;
+        segundos[s] = m->segundos;
+    }
+    MPI_Reduce(local, suma, NUM_ETAPAS * CAMPOS, MPI_UNSIGNED_LONG_LONG, MPI_SUM, 0, comm);
+    MPI_Reduce(segundos, sumaSegundos, NUM_ETAPAS, MPI_DOUBLE, MPI_SUM, 0, comm);
+    MPI_Reduce(c->disponibles, disponibles, NUM_EVENTOS, MPI_INT, MPI_MIN, 0, comm);
+    MPI_Reduce(&c->error, error, 1, MPI_INT, MPI_MAX, 0, comm);
+    MPI_Reduce(c->esLote, es, NUM_ES, MPI_UNSIGNED_LONG_LONG, MPI_SUM, 0, comm);
+    MPI_Reduce(&c->conES, conES, 1, MPI_INT, MPI_MIN, 0, comm);
+
+    int rank;
+    MPI_Comm_rank(comm, &rank);
+    if (rank != 0) return;
+    for (int s = 0; s < NUM_ETAPAS; s++) {
+        MedidaEtapa *m = &total[s];
+        const unsigned long long *l = &suma[s * CAMPOS];
+        memcpy(m->eventos, l, sizeof(m->eventos));
+        m->leidos = l[NUM_EVENTOS + 0];
+        m->escritos = l[NUM_EVENTOS + 1];
+        m->pixeles = l[NUM_EVENTOS + 2];
+        m->llamadas = l[NUM_EVENTOS + 3];
+        m->esLeidos = l[NUM_EVENTOS + 4];
+        m->esEscritos = l[NUM_EVENTOS + 5];
+        m->segundos = sumaSegundos[s];
+    }
+}
+
+void escribirReporteContadores(FILE *f, const MedidaEtapa total[NUM_ETAPAS], const int disponibles[NUM_EVENTOS],
+                               int error, const unsigned long long es[NUM_ES], int conES, double tiempoTotal) {
+    int instr = disponibles[EVENTO_INSTRUCCIONES], ciclos = disponibles[EVENTO_CICLOS];
+    int fallos = disponibles[EVENTO_FALLOS_CACHE], llc = disponibles[EVENTO_CARGAS_LLC];
+
+    fprintf(f, "--- Contadores por filtro ---\n");
+    if (!instr) {
+        int paranoid = -1;
+        FILE *p = fopen("/proc/sys/kernel/perf_event_paranoid", "r");
+        if (p) {
+            if (fscanf(p, "%d", &paranoid) != 1) paranoid = -1;
+            fclose(p);
+        }
+        fprintf(f, "Contadores de hardware no disponibles (%s, perf_event_paranoid=%d): solo tiempo y bytes\n",
+                strerror(error), paranoid);
+    }
+    fprintf(f, "GB/s estimados: bytes que el modelo de cada etapa mueve en memoria, no medidos\n");
+    const double GB = 1024.0 * 1024.0 * 1024.0;
+    if (conES) {
+        // Los archivos mapeados no pasan por read/write: solo aparecen en disco
+        double t = tiempoTotal > 0 ? tiempoTotal : 1;
+        fprintf(f, "E/S real del lote (/proc/self/io): por read/write %.3f GB leidos, %.3f GB escritos (%.2f GB/s); "
+                   "en disco %.3f GB leidos, %.3f GB escritos (%.2f GB/s)\n",
+                es[ES_LEIDOS] / GB, es[ES_ESCRITOS] / GB, (es[ES_LEIDOS] + es[ES_ESCRITOS]) / GB / t,
+                es[ES_DISCO_LEIDOS] / GB, es[ES_DISCO_ESCRITOS] / GB,
+                (es[ES_DISCO_LEIDOS] + es[ES_DISCO_ESCRITOS]) / GB / t);
+    } else {
+        fprintf(f, "E/S real no disponible (sin /proc/self/io)\n");
+    }
+
+    unsigned long long instrTotal = 0;
+    for (int s = 0; s < NUM_ETAPAS; s++) {
+        const MedidaEtapa *m = &total[s];
+        if (m->llamadas == 0) continue;
+        instrTotal += m->eventos[EVENTO_INSTRUCCIONES];
+
+        double gbps = m->segundos > 0 ? (double)(m->leidos + m->escritos) / GB / m->segundos : 0;
+        fprintf(f, "Filtro %-12s: %llu llamadas, %.3f s, %.2f GB/s estimados", nombreEtapa(s), m->llamadas,
+                m->segundos, gbps);
+        if (conES) fprintf(f, ", E/S real %.1f MB", (m->esLeidos + m->esEscritos) / (1024.0 * 1024.0));
+        if (instr && ciclos && m->eventos[EVENTO_CICLOS] > 0)
+            fprintf(f, ", IPC %.2f", (double)m->eventos[EVENTO_INSTRUCCIONES] / m->eventos[EVENTO_CICLOS]);
+        if (instr && m->pixeles > 0)
+            fprintf(f, ", %.1f instr/pixel", (double)m->eventos[EVENTO_INSTRUCCIONES] / m->pixeles);
+        if (fallos) fprintf(f, ", %llu fallos de cache", m->eventos[EVENTO_FALLOS_CACHE]);
+        if (llc) fprintf(f, ", %llu cargas LLC", m->eventos[EVENTO_CARGAS_LLC]);
+        fprintf(f, "\n");
+    }
+    if (instr && tiempoTotal > 0) {
+        fprintf(f, "MIPS medidos: %.2f\n", (double)instrTotal / 1e6 / tiempoTotal);
+    }
+}
@@ -0,0 +1,68 @@
+// contadores.h
+#ifndef CONTADORES_H
+#define CONTADORES_H
+
+#include "image_processing.h"
+#include <mpi.h>
+#include <stdio.h>
+
+// Contadores de hardware por etapa con perf_event_open, uno por hilo OpenMP
+enum {
+    EVENTO_INSTRUCCIONES,
+    EVENTO_CICLOS,
+    EVENTO_FALLOS_CACHE,
+    EVENTO_CARGAS_LLC,
+    NUM_EVENTOS
+};
+
+// E/S real de /proc/<tarea>/io: bytes pasados por read/write (con la cache
+// de paginas) y los que llegaron al disco
+enum {
+    ES_LEIDOS,
+    ES_ESCRITOS,
+    ES_DISCO_LEIDOS,
+    ES_DISCO_ESCRITOS,
+    NUM_ES
+};
+
+typedef struct {
+    unsigned long long eventos[NUM_EVENTOS];
+    unsigned long long leidos, escritos; // estimados: lo que el modelo de cada etapa mueve en memoria
+    unsigned long long esLeidos, esEscritos; // reales: read/write del hilo durante la etapa
+    unsigned long long pixeles, llamadas;
+    double segundos;
+} MedidaEtapa;
+
+typedef struct {
+    int hilos;
+    int (*fds)[NUM_EVENTOS];        // por hilo OpenMP; -1 si no se pudo abrir
+    int disponibles[NUM_EVENTOS];   // abierto en todos los hilos
+    int error;                      // errno al abrir instrucciones, 0 si abrio
+    unsigned long long inicio[NUM_EVENTOS];
+    int conES;                      // /proc/thread-self/io y /proc/self/io legibles
+    unsigned long long esInicio[NUM_ES]; // del hilo, al empezar la etapa
+    unsigned long long esLote[NUM_ES];   // del proceso: al iniciar y, al terminar, lo hecho entre medio
+    double tInicio;
+    MedidaEtapa etapas[NUM_ETAPAS];
+} Contadores;
+
+// Abre los contadores en cada hilo OpenMP y registra el medidor de etapas.
+// Sin permisos (perf_event_paranoid) o sin PMU las etapas se siguen midiendo
+// en tiempo y bytes y los eventos quedan como no disponibles. La E/S real
+// sale de /proc: por etapa la del hilo que la corre, y la del proceso entero
+// entre iniciarContadores y terminarContadores.
+void iniciarContadores(Contadores *c);
+void terminarContadores(Contadores *c);
+
+// Suma las etapas y la E/S del lote de todos los ranks en el rank 0; un
+// evento (o la E/S) queda disponible solo si lo estuvo en todos
+void reducirContadores(const Contadores *c, MedidaEtapa total[NUM_ETAPAS], int disponibles[NUM_EVENTOS],
+                       int *error, unsigned long long es[NUM_ES], int *conES, MPI_Comm comm);
+
+// IPC, GB/s estimados, E/S real e instrucciones por pixel de cada etapa, y
+// la E/S real del lote; tiempoTotal es el de pared del lote para los MIPS
+// medidos y los GB/s reales
+void escribirReporteContadores(FILE *f, const MedidaEtapa total[NUM_ETAPAS], const int disponibles[NUM_EVENTOS],
+                               int error, const unsigned long long es[NUM_ES], int conES, double tiempoTotal);
+
+#endif // CONTADORES_H
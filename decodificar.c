@@ -0,0 +1,22 @@
+// decodificar.c
+// Rebuilds the original BMPs from the .qoib outputs of --salida=qoi, so they
+// can be compared byte for byte (cmp) with a run that wrote BMPs.
+#include "qoi.h"
+#include <stdio.h>
+#include <string.h>
+
+int main(int argc, char *argv[]) {
+    if (argc < 3 || argc % 2 == 0) {
+        fprintf(stderr, "Uso: %s entrada.qoib salida.bmp [entrada.qoib salida.bmp ...]\n", argv[0]);
+        return 1;
+    }
+
+    int errores = 0;
+    for (int a = 1; a + 1 < argc; a += 2) {
+        if (decodificarQOI(argv[a], argv[a + 1], stderr) != 0) {
+            fprintf(stderr, "No se pudo decodificar %s\n", argv[a]);
+            errores++;
+        }
+    }
+    return errores ? 1 : 0;
+}
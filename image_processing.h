@@ -6,6 +6,7 @@
 #include <stdlib.h>
 #include <stdint.h>
 #include <string.h>
+#include "arena.h"
 
 #pragma pack(push, 1)
 typedef struct {
@@ -31,10 +32,313 @@ typedef struct {
 } DIBHeader;
 #pragma pack(pop)
 
-void invertirHorizontalGrises(const char *entrada, const char *salida, FILE *log, unsigned long *lecturas, unsigned long *escrituras);
-void invertirHorizontalColor(const char *entrada, const char *salida, FILE *log, unsigned long *lecturas, unsigned long *escrituras);
-void aplicarDesenfoqueIntegral(const char *entrada, const char *salida, int kernelSize, FILE *log, unsigned long *lecturas, unsigned long *escrituras);
-void invertirVerticalGrises(const char *entrada, const char *salida, FILE *log, unsigned long *lecturas, unsigned long *escrituras);
-void invertirVerticalColor(const char *entrada, const char *salida, FILE *log, unsigned long *lecturas, unsigned long *escrituras);
-void convertirAGrises(const char *entrada, const char *salida, FILE *log, unsigned long *lecturas, unsigned long *escrituras);
-#endif // IMAGE_PROCESSING_H
\ No newline at end of file
+// Imagen BMP de 24 bits de entrada. Al leerla de disco, pixeles apunta dentro
+// del archivo mapeado (mapa) y se lee directo del page cache.
+typedef struct {
+    BMPHeader header;
+    DIBHeader dib;
+    int padding;
+    size_t rowSize;
+    size_t imageSize;
+    const uint8_t *pixeles;
+    void *mapa;
+    size_t tamMapa;
+} ImagenBMP;
+
+// BMP de salida creado con ftruncate + mmap; los kernels escriben las filas
+// directamente en pixeles. Con ARCHIVO_QOI el mapa es memoria (fd = -1) y
+// cerrarSalidaBMP lo codifica en rutaQOI.
+typedef struct {
+    int fd;
+    uint8_t *mapa;
+    size_t tamMapa;
+    uint8_t *pixeles;
+    int ancho, alto;
+    int padding;
+    size_t rowSize;
+    size_t imageSize;
+    char *rutaQOI;
+} SalidaBMP;
+
+// Imagen integral con los tres canales intercalados (B, G, R) en un solo
+// bloque alineado a 64 bytes. Tiene una fila y una columna extra en cero,
+// asi la suma de [x1..x2] x [y1..y2] es
+//   I[y2+1][x2+1] - I[y1][x2+1] - I[y2+1][x1] + I[y1][x1]
+// sin casos de borde. Usa uint32_t (sumas modulo 2^32, exactas para toda
+// region cuya suma real cabe en 32 bits) salvo que la imagen completa pueda
+// desbordar 32 bits, en cuyo caso usa uint64_t.
+typedef struct {
+    int ancho, alto;
+    size_t stride;   // elementos por fila: (ancho + 1) * 3
+    int bits64;
+    void *datos;
+    Arena *arena;    // de donde salio datos (NULL = heap)
+} ImagenIntegral;
+
+// Los buffers de trabajo salen de arena (NULL = malloc/free en cada llamada)
+int construirIntegral(const ImagenBMP *img, ImagenIntegral *ii, Arena *arena);
+void liberarIntegral(ImagenIntegral *ii);
+void sumaRegion(const ImagenIntegral *ii, int x1, int y1, int x2, int y2, uint64_t suma[3]);
+
+// Indices de las salidas que produce cada imagen
+enum {
+    SALIDA_HG,    // _hg: espejo horizontal en grises
+    SALIDA_HC,    // _hc: espejo horizontal en color
+    SALIDA_VG,    // _vg: espejo vertical en grises
+    SALIDA_VC,    // _vc: espejo vertical en color
+    SALIDA_BLUR,  // _blur_k%d: desenfoque
+    SALIDA_GRIS,  // _gris: escala de grises
+    SALIDA_GAUSS, // _gauss_s%.1f: aproximacion gaussiana con tres cajas
+    NUM_SALIDAS
+};
+
+// Kernels del desenfoque de caja de una corrida, una salida _blur_k%d por
+// kernel. La imagen integral (y en el camino por franjas, las filas leidas)
+// no depende del kernel, asi que todos salen de una sola construccion.
+#define MAX_KERNELS 8
+typedef struct {
+    int n;
+    int tamanos[MAX_KERNELS];
+} ListaKernels;
+
+// Tamanos validos: impares (la ventana queda centrada) entre estos limites,
+// los del deslizador de la interfaz
+#define KERNEL_MINIMO 3
+#define KERNEL_MAXIMO 155
+
+// "55,105,155" -> lista; -1 si esta vacia, tiene mas de MAX_KERNELS o algun
+// tamano no es impar entre KERNEL_MINIMO y KERNEL_MAXIMO
+int parsearKernels(const char *texto, ListaKernels *kernels);
+
+// Rutas de salida de una imagen: las NUM_SALIDAS de siempre (SALIDA_BLUR es
+// la del primer kernel) y despues las de los demas kernels
+#define MAX_RUTAS_SALIDA (NUM_SALIDAS + MAX_KERNELS - 1)
+#define RUTA_DESENFOQUE(k) ((k) == 0 ? SALIDA_BLUR : NUM_SALIDAS + (k) - 1)
+
+// Etapas que se pueden medir: una por salida mas las que no producen una
+enum {
+    ETAPA_PLANO_GRISES = NUM_SALIDAS, // plano de grises compartido
+    ETAPA_FRANJAS,                    // todas las salidas por franjas, fusionadas
+    ETAPA_PREVIAS,                    // previas de todas las salidas (previas.h)
+    NUM_ETAPAS
+};
+
+// Instrumentacion opcional: procesarImagenBMP y procesarImagenPorFranjas
+// llaman a inicio() de cada medidor antes del kernel de cada etapa y a fin()
+// despues (en orden inverso), con los bytes que la etapa lee y escribe y los
+// pixeles que produce. Se llama siempre desde el hilo que procesa la imagen.
+typedef struct {
+    void (*inicio)(void *ctx);
+    void (*fin)(void *ctx, int etapa, size_t leidos, size_t escritos, size_t pixeles);
+    void *ctx;
+} MedidorEtapas;
+
+#define MAX_MEDIDORES 4
+
+// -1 si ya hay MAX_MEDIDORES; quitar busca por ctx
+int agregarMedidorEtapas(const MedidorEtapas *medidor);
+void quitarMedidorEtapas(void *ctx);
+// Nombre corto de una etapa ("hg", "blur", "franjas", ...)
+const char *nombreEtapa(int etapa);
+
+// Lectura / escritura de BMP mapeados en memoria. Toda la validacion de
+// BMPHeader/DIBHeader vive en validarCabeceras, que usan leerImagenBMP, las
+// franjas y el manifiesto.
+// NULL si header y dib describen un BMP de 24 bits sin compresion que cabe en
+// tamArchivo bytes (y llena padding, rowSize e imageSize); si no, el motivo
+const char *validarCabeceras(ImagenBMP *img, size_t tamArchivo);
+int leerImagenBMP(const char *entrada, ImagenBMP *img, FILE *log, unsigned long *lecturas);
+void liberarImagenBMP(ImagenBMP *img);
+int crearSalidaBMP(const char *salida, const ImagenBMP *img, int ancho, int alto, SalidaBMP *out, FILE *log);
+int cerrarSalidaBMP(SalidaBMP *out, unsigned long *escrituras); // -1 si no se pudo escribir
+
+// Kernels sobre imagenes en memoria (salida con el mismo rowSize que la entrada).
+// Los grises usan punto fijo Q15: a lo sumo 1 nivel de diferencia contra
+// 0.21*r + 0.72*g + 0.07*b en double. Compilar con -mssse3 o -mavx2
+// (o -march=native) habilita las rutas SIMD.
+// Desviacion maxima de los grises en punto fijo respecto de
+// (uint8_t)(0.21*r + 0.72*g + 0.07*b) en double
+#define DESVIACION_MAXIMA_GRISES 1
+// Recorre los 2^24 colores con el camino escalar y cada camino SIMD
+// compilado, informa la desviacion de cada uno en salida (si no es NULL) y
+// devuelve cuantos superan DESVIACION_MAXIMA_GRISES
+int verificarGrises(FILE *salida);
+void calcularGrises(const ImagenBMP *img, uint8_t *gris);
+void expandirGrises(const ImagenBMP *img, const uint8_t *gris, uint8_t *salida, int espejoHorizontal, int espejoVertical);
+void convertirGrisesBGR(const ImagenBMP *img, uint8_t *salida, int espejoHorizontal, int espejoVertical);
+void espejoHorizontalColor(const ImagenBMP *img, uint8_t *salida);
+void espejoVerticalColor(const ImagenBMP *img, uint8_t *salida);
+// Rotaciones en sentido visual (la imagen vista de arriba hacia abajo).
+// ROTAR_90, ROTAR_270 y TRANSPONER intercambian ancho y alto: la salida
+// debe tener rowSize de una fila de img->dib.height pixeles.
+typedef enum {
+    ROTAR_90,    // 90 grados en sentido horario
+    ROTAR_180,
+    ROTAR_270,   // 90 grados en sentido antihorario
+    TRANSPONER   // reflejo sobre la diagonal principal
+} Rotacion;
+
+void rotarImagen(const ImagenBMP *img, uint8_t *salida, size_t rowSizeSalida, Rotacion rotacion);
+int desenfoqueIntegral(const ImagenBMP *img, uint8_t *salida, int kernelSize, Arena *arena);
+// Un desenfoque por kernel (salidas[k] con kernels[k]) de una sola imagen integral
+int desenfoqueIntegralKernels(const ImagenBMP *img, uint8_t *const *salidas, const int *kernels, int n, Arena *arena);
+int desenfoqueSeparable(const ImagenBMP *img, uint8_t *salida, int kernelSize, Arena *arena);
+
+// Motor de desenfoque usado por procesarImagenCompleta; ambos producen el
+// mismo promedio sobre la ventana recortada a la imagen, byte por byte
+typedef enum {
+    DESENFOQUE_INTEGRAL,  // imagen integral 2D
+    DESENFOQUE_SEPARABLE  // sumas corredizas por columnas y filas, O(1) por pixel
+} MetodoDesenfoque;
+
+void establecerMetodoDesenfoque(MetodoDesenfoque metodo);
+MetodoDesenfoque obtenerMetodoDesenfoque(void);
+int desenfocar(const ImagenBMP *img, uint8_t *salida, int kernelSize, Arena *arena);
+// Varios kernels con el motor configurado; el separable no comparte nada
+int desenfocarKernels(const ImagenBMP *img, uint8_t *const *salidas, const int *kernels, int n, Arena *arena);
+
+// Aproximacion gaussiana: tres desenfoques de caja seguidos (con el motor
+// configurado) cuyos tamanos suman la varianza sigma^2, asi el costo sigue
+// siendo O(1) por pixel para cualquier sigma. Cada pasada redondea a 8 bits
+// y recorta la ventana a la imagen como desenfocar.
+#define PASADAS_GAUSS 3
+
+// sigma <= 0 (por defecto) usa la del desenfoque de caja de la corrida:
+// sqrt((k^2 - 1) / 12), la misma varianza que una caja de kernelSize
+void establecerSigmaGauss(double sigma);
+double sigmaGauss(int kernelSize);
+// Tamanos impares de las cajas para sigma
+void tamanosCajasGauss(double sigma, int tamanos[PASADAS_GAUSS]);
+int desenfoqueGaussiano(const ImagenBMP *img, uint8_t *salida, double sigma, Arena *arena);
+
+// Salidas que son una permutacion pura de filas de la entrada. En
+// VOLTEO_SIN_COPIA las filas van de la entrada mapeada a la salida con
+// pwritev, sin buffers ni kernel de pixeles; VOLTEO_TOPDOWN escribe los
+// pixeles tal cual con altura negativa (BMP top-down), solo para consumidores
+// que lo acepten. leerImagenBMP no acepta BMP top-down.
+typedef enum {
+    VOLTEO_MAPEADO,   // kernel de copia por filas sobre la salida mapeada
+    VOLTEO_SIN_COPIA, // pwritev de filas en orden inverso
+    VOLTEO_TOPDOWN    // mismas filas, altura negativa
+} ModoVolteoVertical;
+
+void establecerModoVolteoVertical(ModoVolteoVertical modo);
+ModoVolteoVertical obtenerModoVolteoVertical(void);
+
+// Formato de las salidas en grises (_hg, _vg, _gris). En GRISES_8BITS son
+// BMP de 8 bits con una paleta de 256 grises: un tercio de los bytes de
+// pixel de la version de 24 bits, con el mismo contenido visual.
+typedef enum {
+    GRISES_24BITS, // B = G = R en cada pixel, como la entrada
+    GRISES_8BITS   // un indice de paleta (el gris) por pixel
+} FormatoGrises;
+
+#define NUM_SALIDAS_GRISES 3
+
+void establecerFormatoGrises(FormatoGrises formato);
+FormatoGrises obtenerFormatoGrises(void);
+int esSalidaGrises(int salida);
+// BMP de 8 bits del tamano de img con la paleta de grises, mapeado como en
+// crearSalidaBMP (out->rowSize es el de una fila de 8 bits)
+int crearSalidaGrisesBMP(const char *salida, const ImagenBMP *img, SalidaBMP *out, FILE *log);
+// Plano de grises -> filas de 8 bits de rowSizeSalida bytes
+void escribirGrises8(const ImagenBMP *img, const uint8_t *gris, uint8_t *salida, size_t rowSizeSalida,
+                     int espejoHorizontal, int espejoVertical);
+// Escala de grises directa de la imagen a 8 bits
+void convertirGrises8(const ImagenBMP *img, uint8_t *salida, size_t rowSizeSalida, int espejoHorizontal, int espejoVertical);
+// Formato de archivo de todas las salidas. ARCHIVO_QOI las codifica sin
+// perdida por bandas (ver qoi.h); decodificar.exe reconstruye el BMP.
+typedef enum {
+    ARCHIVO_BMP,
+    ARCHIVO_QOI
+} FormatoArchivo;
+
+void establecerFormatoArchivo(FormatoArchivo formato);
+FormatoArchivo obtenerFormatoArchivo(void);
+// ".bmp" o ".qoib" segun el formato
+const char *extensionSalida(void);
+
+// Todo lo que, ademas de los bytes de la entrada, cambia los bytes de un
+// archivo de salida (o de su previa): la etiqueta de la cache sale solo de
+// aca. Una opcion nueva que cambie alguna salida se agrega al struct, a
+// opcionesSalida y a describirOpcionesSalida; los motores que dan los mismos
+// bytes (desenfoque integral o separable, franjas, volteo mapeado o sin
+// copia) no entran.
+typedef struct {
+    int salida;             // SALIDA_* o RUTA_DESENFOQUE(k)
+    int previa;             // 1 = la previa de la salida (siempre BMP de 24 bits)
+    int ladoPrevia;
+    int kernel;             // desenfoque de caja
+    double sigma;           // gaussiano
+    int grises8;            // salidas en grises como BMP de 8 bits
+    int topdown;            // espejo vertical en color con altura negativa
+    FormatoArchivo archivo;
+} OpcionesSalida;
+
+// Opciones vigentes para la salida s (indexada como las rutas); los campos
+// que no afectan a esa salida quedan en cero, asi p. ej. _hc se comparte
+// entre corridas con distinto kernel
+void opcionesSalida(int s, int previa, const ListaKernels *kernels, OpcionesSalida *o);
+// Texto distinto para cada combinacion de opciones ("blur_k55_s0_g0_t0_p0.bmp");
+// devuelve lo que escribio snprintf
+int describirOpcionesSalida(const OpcionesSalida *o, char *texto, size_t tam);
+int escribirEspejoVertical(const char *salida, const ImagenBMP *img, FILE *log, unsigned long *escrituras);
+int escribirCopiaBMP(const char *salida, const ImagenBMP *img, FILE *log, unsigned long *escrituras);
+
+// Efectos de archivo a archivo: 0 si la salida quedo escrita; -1 si no, con
+// el motivo en log y sin dejar la salida a medias
+int invertirHorizontalGrises(const char *entrada, const char *salida, FILE *log, unsigned long *lecturas, unsigned long *escrituras);
+int invertirHorizontalColor(const char *entrada, const char *salida, FILE *log, unsigned long *lecturas, unsigned long *escrituras);
+int aplicarDesenfoqueIntegral(const char *entrada, const char *salida, int kernelSize, FILE *log, unsigned long *lecturas, unsigned long *escrituras);
+int aplicarDesenfoqueSeparable(const char *entrada, const char *salida, int kernelSize, FILE *log, unsigned long *lecturas, unsigned long *escrituras);
+// Una lectura y una imagen integral para todos los kernels; lecturas cuenta
+// la lectura real una vez
+int aplicarDesenfoqueIntegralKernels(const char *entrada, const char *const *salidas, const ListaKernels *kernels,
+                                     FILE *log, unsigned long *lecturas, unsigned long *escrituras);
+int aplicarDesenfoqueGaussiano(const char *entrada, const char *salida, double sigma, FILE *log, unsigned long *lecturas, unsigned long *escrituras);
+int invertirVerticalGrises(const char *entrada, const char *salida, FILE *log, unsigned long *lecturas, unsigned long *escrituras);
+int invertirVerticalColor(const char *entrada, const char *salida, FILE *log, unsigned long *lecturas, unsigned long *escrituras);
+int convertirAGrises(const char *entrada, const char *salida, FILE *log, unsigned long *lecturas, unsigned long *escrituras);
+int rotar90(const char *entrada, const char *salida, FILE *log, unsigned long *lecturas, unsigned long *escrituras);
+int rotar180(const char *entrada, const char *salida, FILE *log, unsigned long *lecturas, unsigned long *escrituras);
+int rotar270(const char *entrada, const char *salida, FILE *log, unsigned long *lecturas, unsigned long *escrituras);
+int transponer(const char *entrada, const char *salida, FILE *log, unsigned long *lecturas, unsigned long *escrituras);
+
+// Salidas mapeadas que quedan abiertas para que otro hilo las cierre
+#define MAX_SALIDAS_PENDIENTES MAX_RUTAS_SALIDA
+typedef struct {
+    SalidaBMP salidas[MAX_SALIDAS_PENDIENTES];
+    int n;
+} SalidasPendientes;
+
+// Produce las salidas de una imagen ya leida, una de desenfoque por kernel
+// (salidas indexadas por SALIDA_* y RUTA_DESENFOQUE). Si pendientes no es
+// NULL, las salidas mapeadas se dejan abiertas en pendientes y el llamador
+// las cierra con cerrarSalidaBMP (y cuenta ahi sus escrituras y fallos).
+// Devuelve cuantas salidas (o previas) no se pudieron crear o escribir.
+int procesarImagenBMP(const ImagenBMP *img, const char *salidas[MAX_RUTAS_SALIDA], const ListaKernels *kernels,
+                      FILE *log, unsigned long *escrituras, SalidasPendientes *pendientes, Arena *arena);
+
+// Lee la imagen una sola vez y produce todas sus salidas. lecturas cuenta la
+// unica lectura real; lecturasBlur la lectura logica de un desenfoque (el
+// llamador la pondera por el area de cada kernel). Devuelve -1 si no se pudo
+// leer la entrada y si no los fallos de procesarImagenBMP: 0 es todo escrito.
+int procesarImagenCompleta(const char *entrada, const char *salidas[MAX_RUTAS_SALIDA], const ListaKernels *kernels,
+                           FILE *log, unsigned long *lecturas, unsigned long *lecturasBlur, unsigned long *escrituras,
+                           Arena *arena);
+
+// Memoria de trabajo (sin contar entrada y salidas mapeadas) que necesita
+// procesarImagenBMP para una imagen de ancho x alto con el desenfoque actual
+size_t memoriaImagenCompleta(int ancho, int alto);
+
+// Mismas salidas que procesarImagenCompleta sin mapear la imagen: se lee y
+// escribe por franjas de filas y la memoria de trabajo queda acotada por
+// presupuesto (en bytes) en lugar de por el alto de la imagen. El minimo es
+// del orden del kernel mayor + 6 filas + una por kernel, mas los radios de
+// las cajas del gaussiano. Devuelve -1 si fallo la lectura, la memoria o
+// alguna escritura y si no cuantas salidas no se pudieron crear: 0 es todo
+// escrito.
+int procesarImagenPorFranjas(const char *entrada, const char *salidas[MAX_RUTAS_SALIDA], const ListaKernels *kernels,
+                             size_t presupuesto, FILE *log, unsigned long *lecturas, unsigned long *lecturasBlur, unsigned long *escrituras,
+                             Arena *arena);
+#endif // IMAGE_PROCESSING_H
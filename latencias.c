@@ -0,0 +1,257 @@
+// latencias.c
+#include "latencias.h"
+#include <math.h>
+#include <omp.h>
+#include <stdlib.h>
+#include <string.h>
+
+static int cubetaLatencia(double segundos) {
+    double us = segundos * 1e6;
+    if (us < 1.0) return 0;
+    int c = 1 + (int)(4.0 * log2(us));
+    return c < CUBETAS_LATENCIA ? c : CUBETAS_LATENCIA - 1;
+}
+
+static void agregarMuestra(HistogramaLatencia *h, double segundos) {
+    h->cubetas[cubetaLatencia(segundos)]++;
+    h->llamadas++;
+    h->segundos += segundos;
+    if (segundos > h->max) h->max = segundos;
+}
+
+double percentilLatencia(const HistogramaLatencia *h, double p) {
+    if (h->llamadas == 0) return 0.0;
+    unsigned long long objetivo = (unsigned long long)ceil(p * h->llamadas), acumulado = 0;
+    if (objetivo < 1) objetivo = 1;
+    for (int c = 0; c < CUBETAS_LATENCIA; c++) {
+        acumulado += h->cubetas[c];
+        if (acumulado >= objetivo) {
+            double limite = c == 0 ? 1e-6 : exp2(c / 4.0) * 1e-6;
+            return limite < h->max ? limite : h->max;
+        }
+    }
+    return h->max;
+}
+
+static void inicioEtapa(void *ctx) {
+    Latencias *l = ctx;
+    l->tInicio = omp_get_wtime();
+}
+
+static void finEtapa(void *ctx, int etapa, size_t leidos, size_t escritos, size_t pixeles) {
+    (void)pixeles;
+    Latencias *l = ctx;
+    double segundos = omp_get_wtime() - l->tInicio;
+    agregarMuestra(&l->h[etapa], segundos);
+    l->actual[etapa] += segundos;
+    l->leidos += leidos;
+    l->escritos += escritos;
+}
+
+void iniciarLatencias(Latencias *l) {
+    memset(l, 0, sizeof(*l));
+    for (int i = 0; i < MAX_LENTAS; i++) l->lentas[i].indice = -1;
+    MedidorEtapas m = { inicioEtapa, finEtapa, l };
+    agregarMedidorEtapas(&m);
+}
+
+void terminarLatencias(Latencias *l) {
+    quitarMedidorEtapas(l);
+}
+
+void registrarImagenLatencia(Latencias *l, int indice, double segundos) {
+    agregarMuestra(&l->h[LATENCIA_IMAGEN], segundos);
+
+    // Insercion en la lista de mas lentas, ordenada de mayor a menor
+    int pos = MAX_LENTAS;
+    while (pos > 0 && (l->lentas[pos - 1].indice < 0 || l->lentas[pos - 1].segundos < segundos)) pos--;
+    if (pos < MAX_LENTAS) {
+        memmove(&l->lentas[pos + 1], &l->lentas[pos], (MAX_LENTAS - pos - 1) * sizeof(ImagenLenta));
+        l->lentas[pos].indice = indice;
+        l->lentas[pos].segundos = segundos;
+        memcpy(l->lentas[pos].etapas, l->actual, sizeof(l->actual));
+    }
+    memset(l->actual, 0, sizeof(l->actual));
+}
+
+// Lo que cada rank manda al rank 0, en dos arreglos planos
+#define ENTEROS_RANK (NUM_LATENCIAS * (CUBETAS_LATENCIA + 1) + 2)
+#define CAMPOS_LENTA (2 + NUM_ETAPAS)
+#define REALES_RANK (NUM_LATENCIAS * 2 + 2 + MAX_LENTAS * CAMPOS_LENTA)
+
+static void empaquetar(const Latencias *l, double pared, double espera,
+                       unsigned long long *enteros, double *reales) {
+    for (int e = 0; e < NUM_LATENCIAS; e++) {
+        unsigned long long *u = &enteros[e * (CUBETAS_LATENCIA + 1)];
+        memcpy(u, l->h[e].cubetas, sizeof(l->h[e].cubetas));
+        u[CUBETAS_LATENCIA] = l->h[e].llamadas;
+        reales[2 * e] = l->h[e].segundos;
+        reales[2 * e + 1] = l->h[e].max;
+    }
+    enteros[NUM_LATENCIAS * (CUBETAS_LATENCIA + 1)] = l->leidos;
+    enteros[NUM_LATENCIAS * (CUBETAS_LATENCIA + 1) + 1] = l->escritos;
+    reales[NUM_LATENCIAS * 2] = pared;
+    reales[NUM_LATENCIAS * 2 + 1] = espera;
+    for (int i = 0; i < MAX_LENTAS; i++) {
+        double *r = &reales[NUM_LATENCIAS * 2 + 2 + i * CAMPOS_LENTA];
+        r[0] = l->lentas[i].indice;
+        r[1] = l->lentas[i].segundos;
+        memcpy(&r[2], l->lentas[i].etapas, sizeof(l->lentas[i].etapas));
+    }
+}
+
+static void desempaquetar(const unsigned long long *enteros, const double *reales, HistogramaLatencia h[NUM_LATENCIAS]) {
+    for (int e = 0; e < NUM_LATENCIAS; e++) {
+        const unsigned long long *u = &enteros[e * (CUBETAS_LATENCIA + 1)];
+        memcpy(h[e].cubetas, u, sizeof(h[e].cubetas));
+        h[e].llamadas = u[CUBETAS_LATENCIA];
+        h[e].segundos = reales[2 * e];
+        h[e].max = reales[2 * e + 1];
+    }
+}
+
+static void escribirCadenaJSON(FILE *f, const char *s) {
+    fputc('"', f);
+    for (; *s; s++) {
+        unsigned char c = (unsigned char)*s;
+        if (c == '"' || c == '\\') fprintf(f, "\\%c", c);
+        else if (c < 0x20) fprintf(f, "\\u%04x", c);
+        else fputc(c, f);
+    }
+    fputc('"', f);
+}
+
+// Un objeto por etapa con muestras; la imagen completa va como "imagen"
+static void escribirFiltrosJSON(FILE *f, const HistogramaLatencia h[NUM_LATENCIAS], const char *sangria) {
+    fprintf(f, "{");
+    int primero = 1;
+    for (int e = 0; e < NUM_LATENCIAS; e++) {
+        if (h[e].llamadas == 0) continue;
+        fprintf(f, "%s\n%s  ", primero ? "" : ",", sangria);
+        escribirCadenaJSON(f, e == LATENCIA_IMAGEN ? "imagen" : nombreEtapa(e));
+        fprintf(f, ": {\"llamadas\": %llu, \"total_s\": %.6f, \"p50_s\": %.6f, \"p95_s\": %.6f, "
+                   "\"p99_s\": %.6f, \"max_s\": %.6f}",
+                h[e].llamadas, h[e].segundos, percentilLatencia(&h[e], 0.50), percentilLatencia(&h[e], 0.95),
+                percentilLatencia(&h[e], 0.99), h[e].max);
+        primero = 0;
+    }
+    fprintf(f, "%s}", primero ? "" : "\n");
+}
+
+typedef struct {
+    int rank;
+    const double *datos;     // indice, segundos, etapas
+} LentaRank;
+
+static int compararLentas(const void *a, const void *b) {
+    double sa = ((const LentaRank *)a)->datos[1], sb = ((const LentaRank *)b)->datos[1];
+    return (sa < sb) - (sa > sb);
+}
+
+static void escribirJSON(FILE *f, int size, const unsigned long long *todosEnteros, const double *todosReales,
+                         HistogramaLatencia *porRank, LentaRank *lentas, const Manifiesto *m,
+                         const ListaKernels *kernels) {
+    HistogramaLatencia global[NUM_LATENCIAS];
+
+    // Suma de histogramas; los maximos se combinan con max
+    memset(global, 0, sizeof(global));
+    int numLentas = 0;
+    double paredMax = 0;
+    for (int r = 0; r < size; r++) {
+        HistogramaLatencia *h = &porRank[r * NUM_LATENCIAS];
+        const double *rr = &todosReales[(size_t)r * REALES_RANK];
+        desempaquetar(&todosEnteros[(size_t)r * ENTEROS_RANK], rr, h);
+        for (int e = 0; e < NUM_LATENCIAS; e++) {
+            for (int c = 0; c < CUBETAS_LATENCIA; c++) global[e].cubetas[c] += h[e].cubetas[c];
+            global[e].llamadas += h[e].llamadas;
+            global[e].segundos += h[e].segundos;
+            if (h[e].max > global[e].max) global[e].max = h[e].max;
+        }
+        if (rr[NUM_LATENCIAS * 2] > paredMax) paredMax = rr[NUM_LATENCIAS * 2];
+        for (int i = 0; i < MAX_LENTAS; i++) {
+            const double *d = &rr[NUM_LATENCIAS * 2 + 2 + i * CAMPOS_LENTA];
+            if (d[0] < 0) break;
+            lentas[numLentas].rank = r;
+            lentas[numLentas].datos = d;
+            numLentas++;
+        }
+    }
+    qsort(lentas, numLentas, sizeof(LentaRank), compararLentas);
+
+    // "kernel" es el primero de la lista, el de siempre; "kernels" la lista entera
+    fprintf(f, "{\n  \"kernel\": %d,\n  \"kernels\": [", kernels->tamanos[0]);
+    for (int k = 0; k < kernels->n; k++) fprintf(f, k ? ", %d" : "%d", kernels->tamanos[k]);
+    fprintf(f, "],\n  \"ranks\": %d,\n  \"imagenes\": %llu,\n  \"tiempo_total_s\": %.6f,\n",
+            size, global[LATENCIA_IMAGEN].llamadas, paredMax);
+    fprintf(f, "  \"filtros\": ");
+    escribirFiltrosJSON(f, global, "  ");
+    fprintf(f, ",\n  \"por_rank\": [");
+    for (int r = 0; r < size; r++) {
+        const HistogramaLatencia *h = &porRank[r * NUM_LATENCIAS];
+        const unsigned long long *bytes = &todosEnteros[(size_t)r * ENTEROS_RANK + NUM_LATENCIAS * (CUBETAS_LATENCIA + 1)];
+        const double *rr = &todosReales[(size_t)r * REALES_RANK];
+        fprintf(f, "%s\n    {\"rank\": %d, \"imagenes\": %llu, \"ocupado_s\": %.6f, \"espera_s\": %.6f, "
+                   "\"pared_s\": %.6f, \"bytes_leidos\": %llu, \"bytes_escritos\": %llu,\n     \"filtros\": ",
+                r > 0 ? "," : "", r, h[LATENCIA_IMAGEN].llamadas, h[LATENCIA_IMAGEN].segundos,
+                rr[NUM_LATENCIAS * 2 + 1], rr[NUM_LATENCIAS * 2], bytes[0], bytes[1]);
+        escribirFiltrosJSON(f, h, "     ");
+        fprintf(f, "}");
+    }
+    fprintf(f, "\n  ],\n  \"imagenes_mas_lentas\": [");
+    for (int i = 0; i < numLentas && i < MAX_LENTAS; i++) {
+        const double *d = lentas[i].datos;
+        int indice = (int)d[0];
+        fprintf(f, "%s\n    {\"imagen\": ", i > 0 ? "," : "");
+        escribirCadenaJSON(f, indice < m->n ? m->entradas[indice].nombre : "?");
+        fprintf(f, ", \"rank\": %d, \"total_s\": %.6f, \"filtros\": {", lentas[i].rank, d[1]);
+        int primero = 1;
+        for (int e = 0; e < NUM_ETAPAS; e++) {
+            if (d[2 + e] <= 0) continue;
+            fprintf(f, "%s", primero ? "" : ", ");
+            escribirCadenaJSON(f, nombreEtapa(e));
+            fprintf(f, ": %.6f", d[2 + e]);
+            primero = 0;
+        }
+        fprintf(f, "}}");
+    }
+    fprintf(f, "\n  ]\n}\n");
+}
+
+int escribirReporteLatencias(const Latencias *l, const char *ruta, const Manifiesto *m, const ListaKernels *kernels,
+                             double pared, double espera, MPI_Comm comm) {
+    int rank, size;
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &size);
+
+    unsigned long long enteros[ENTEROS_RANK];
+    double reales[REALES_RANK];
+    empaquetar(l, pared, espera, enteros, reales);
+
+    unsigned long long *todosEnteros = NULL;
+    double *todosReales = NULL;
+    if (rank == 0) {
+        todosEnteros = malloc((size_t)size * ENTEROS_RANK * sizeof(unsigned long long));
+        todosReales = malloc((size_t)size * REALES_RANK * sizeof(double));
+    }
+    MPI_Gather(enteros, ENTEROS_RANK, MPI_UNSIGNED_LONG_LONG, todosEnteros, ENTEROS_RANK,
+               MPI_UNSIGNED_LONG_LONG, 0, comm);
+    MPI_Gather(reales, REALES_RANK, MPI_DOUBLE, todosReales, REALES_RANK, MPI_DOUBLE, 0, comm);
+    if (rank != 0) return 0;
+
+    int resultado = -1;
+    HistogramaLatencia *porRank = calloc((size_t)size * NUM_LATENCIAS, sizeof(HistogramaLatencia));
+    LentaRank *lentas = malloc((size_t)size * MAX_LENTAS * sizeof(LentaRank));
+    if (todosEnteros && todosReales && porRank && lentas) {
+        FILE *f = fopen(ruta, "w");
+        if (f) {
+            escribirJSON(f, size, todosEnteros, todosReales, porRank, lentas, m, kernels);
+            fclose(f);
+            resultado = 0;
+        }
+    }
+    free(lentas);
+    free(porRank);
+    free(todosEnteros);
+    free(todosReales);
+    return resultado;
+}
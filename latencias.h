@@ -0,0 +1,55 @@
+// latencias.h
+#ifndef LATENCIAS_H
+#define LATENCIAS_H
+
+#include "image_processing.h"
+#include "manifiesto.h"
+#include <mpi.h>
+#include <stdio.h>
+
+// Histograma logaritmico: 4 cubetas por potencia de dos de microsegundos,
+// la 0 para menos de 1 us; la ultima junta todo lo mayor (~ 9 min)
+#define CUBETAS_LATENCIA 120
+// Las etapas mas una entrada para la imagen completa
+#define LATENCIA_IMAGEN NUM_ETAPAS
+#define NUM_LATENCIAS (NUM_ETAPAS + 1)
+// Imagenes mas lentas que guarda cada rank con su desglose por etapa
+#define MAX_LENTAS 8
+
+typedef struct {
+    unsigned long long cubetas[CUBETAS_LATENCIA];
+    unsigned long long llamadas;
+    double segundos, max;
+} HistogramaLatencia;
+
+typedef struct {
+    int indice;                       // entrada del manifiesto, -1 si libre
+    double segundos;
+    double etapas[NUM_ETAPAS];
+} ImagenLenta;
+
+typedef struct {
+    HistogramaLatencia h[NUM_LATENCIAS];
+    unsigned long long leidos, escritos; // bytes de las etapas
+    double tInicio;
+    double actual[NUM_ETAPAS];        // etapas de la imagen en curso
+    ImagenLenta lentas[MAX_LENTAS];   // de mayor a menor
+} Latencias;
+
+// Registra el medidor de etapas; cada llamada a una etapa suma una muestra
+void iniciarLatencias(Latencias *l);
+void terminarLatencias(Latencias *l);
+// Cierra la imagen en curso: muestra de imagen completa y candidata a lenta
+void registrarImagenLatencia(Latencias *l, int indice, double segundos);
+
+// Percentil p (0..1) estimado del histograma: limite superior de la cubeta,
+// acotado por el maximo
+double percentilLatencia(const HistogramaLatencia *h, double p);
+
+// Reune los histogramas, los totales por rank y las imagenes mas lentas en
+// el rank 0 y escribe ahi el reporte JSON. Colectiva en comm; pared y
+// espera son los segundos de lote y de espera de trabajo de este rank.
+int escribirReporteLatencias(const Latencias *l, const char *ruta, const Manifiesto *m, const ListaKernels *kernels,
+                             double pared, double espera, MPI_Comm comm);
+
+#endif // LATENCIAS_H
@@ -0,0 +1,620 @@
+// lote.c
+#include "lote.h"
+#include "qoi.h"
+#include <dirent.h>
+#include <fcntl.h>
+#include <omp.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+// Sum of k*k over the kernels: the window reads of one blur pass per kernel
+static unsigned long long lecturasPorPixelBlur(const ListaKernels *kernels) {
+    unsigned long long total = 0;
+    for (int k = 0; k < kernels->n; k++) total += (unsigned long long)kernels->tamanos[k] * kernels->tamanos[k];
+    return total;
+}
+
+// Input and output paths of one manifest entry
+typedef struct {
+    char entrada[512];
+    char salidas[MAX_RUTAS_SALIDA][512];
+    char previas[MAX_RUTAS_SALIDA][512]; // only with previews on
+} RutasImagen;
+
+static void armarRutas(const EstadoRank *st, int i, RutasImagen *r) {
+    const EntradaManifiesto *e = &st->manifiesto->entradas[i];
+    char base[MAX_NOMBRE_IMAGEN];
+    strcpy(base, e->nombre);
+    char *ext = strrchr(base, '.');
+    if (ext) *ext = '\0';
+
+    snprintf(r->entrada, sizeof(r->entrada), "%s/%s", st->imagesDir, e->nombre);
+    const char *x = extensionSalida();
+    snprintf(r->salidas[SALIDA_HG],   sizeof(r->salidas[0]), "%s/%s_hg%s", st->outputDir, base, x);
+    snprintf(r->salidas[SALIDA_HC],   sizeof(r->salidas[0]), "%s/%s_hc%s", st->outputDir, base, x);
+    snprintf(r->salidas[SALIDA_VG],   sizeof(r->salidas[0]), "%s/%s_vg%s", st->outputDir, base, x);
+    snprintf(r->salidas[SALIDA_VC],   sizeof(r->salidas[0]), "%s/%s_vc%s", st->outputDir, base, x);
+    snprintf(r->salidas[SALIDA_GRIS], sizeof(r->salidas[0]), "%s/%s_gris%s", st->outputDir, base, x);
+    snprintf(r->salidas[SALIDA_GAUSS], sizeof(r->salidas[0]), "%s/%s_gauss_s%.1f%s", st->outputDir, base,
+             sigmaGauss(st->kernels.tamanos[0]), x);
+    for (int k = 0; k < st->kernels.n; k++) {
+        snprintf(r->salidas[RUTA_DESENFOQUE(k)], sizeof(r->salidas[0]), "%s/%s_blur_k%d%s", st->outputDir, base,
+                 st->kernels.tamanos[k], x);
+    }
+    if (obtenerLadoPrevias() > 0) {
+        for (int s = 0; s < NUM_SALIDAS + st->kernels.n - 1; s++) {
+            rutaPrevia(r->salidas[s], r->previas[s], sizeof(r->previas[0]));
+        }
+    }
+}
+
+// Files the cache and the journal track per image: the outputs, then their
+// previews when they are on
+static int archivosPorImagen(const EstadoRank *st) {
+    return (NUM_SALIDAS + st->kernels.n - 1) * (obtenerLadoPrevias() > 0 ? 2 : 1);
+}
+
+static const char *rutaArchivo(const EstadoRank *st, const RutasImagen *r, int j) {
+    int numRutas = NUM_SALIDAS + st->kernels.n - 1;
+    return j < numRutas ? r->salidas[j] : r->previas[j - numRutas];
+}
+
+// --------- Journal ---------
+
+void borrarDiarios(const char *outputDir) {
+    DIR *dir = opendir(outputDir);
+    if (!dir) return;
+    struct dirent *d;
+    char ruta[1024];
+    while ((d = readdir(dir)) != NULL) {
+        if (strncmp(d->d_name, PREFIJO_DIARIO, strlen(PREFIJO_DIARIO)) != 0) continue;
+        snprintf(ruta, sizeof(ruta), "%s/%s", outputDir, d->d_name);
+        unlink(ruta);
+    }
+    closedir(dir);
+}
+
+int abrirDiario(EstadoRank *st) {
+    char ruta[1024];
+    snprintf(ruta, sizeof(ruta), "%s/%s%d.txt", st->outputDir, PREFIJO_DIARIO, st->rank);
+    st->diario = open(ruta, O_WRONLY | O_CREAT | O_APPEND, 0644);
+    return st->diario < 0 ? -1 : 0;
+}
+
+void cerrarDiario(EstadoRank *st) {
+    if (st->diario >= 0) close(st->diario);
+    st->diario = -1;
+}
+
+// One write per line, so a crash never leaves half a name behind
+static void anotarDiario(int diario, const char *nombre) {
+    if (diario < 0) return;
+    char linea[MAX_NOMBRE_IMAGEN + 1];
+    int n = snprintf(linea, sizeof(linea), "%s\n", nombre);
+    if (write(diario, linea, n) != n) return;
+}
+
+static int salidasCompletas(const EstadoRank *st, int i) {
+    const EntradaManifiesto *e = &st->manifiesto->entradas[i];
+    RutasImagen r;
+    armarRutas(st, i, &r);
+    struct stat entrada;
+    if (stat(r.entrada, &entrada) != 0) return 0;
+
+    // BMP sizes are known; QOI sizes depend on the content, so their header
+    // and band table must agree with the file size instead
+    int bmp = obtenerFormatoArchivo() == ARCHIVO_BMP;
+    int grises8 = obtenerFormatoGrises() == GRISES_8BITS;
+    int numRutas = NUM_SALIDAS + st->kernels.n - 1;
+    for (int j = 0; j < archivosPorImagen(st); j++) {
+        const char *ruta = rutaArchivo(st, &r, j);
+        struct stat salida;
+        if (stat(ruta, &salida) != 0 || salida.st_mtime < entrada.st_mtime) return 0;
+        if (j >= numRutas) continue; // previews: written whole or unlinked
+        int gris8 = grises8 && esSalidaGrises(j);
+        if (bmp && salida.st_size != (gris8 ? tamanoSalidaGrisesBMP(e) : tamanoSalidaBMP(e))) return 0;
+        if (!bmp && validarArchivoQOI(ruta, e->ancho, e->alto, gris8 ? 1 : 3) != 0) return 0;
+    }
+    return 1;
+}
+
+static const Manifiesto *manifiestoNombres;
+
+static int compararNombres(const void *a, const void *b) {
+    return strcmp(manifiestoNombres->entradas[*(const int *)a].nombre,
+                  manifiestoNombres->entradas[*(const int *)b].nombre);
+}
+
+static int buscarNombre(const void *nombre, const void *i) {
+    return strcmp(nombre, manifiestoNombres->entradas[*(const int *)i].nombre);
+}
+
+void buscarCompletas(const EstadoRank *st, int numRanks, char *completas) {
+    const Manifiesto *m = st->manifiesto;
+    memset(completas, 0, m->n);
+    DIR *dir = opendir(st->outputDir);
+    int *porNombre = malloc((m->n > 0 ? m->n : 1) * sizeof(int));
+    char *anotadas = calloc(m->n > 0 ? m->n : 1, 1);
+    if (!dir || !porNombre || !anotadas) {
+        if (dir) closedir(dir);
+        free(porNombre);
+        free(anotadas);
+        return;
+    }
+    for (int i = 0; i < m->n; i++) porNombre[i] = i;
+    manifiestoNombres = m;
+    qsort(porNombre, m->n, sizeof(int), compararNombres);
+
+    // Every journal counts: the rank that wrote one may have another number now
+    struct dirent *d;
+    char ruta[1024], linea[MAX_NOMBRE_IMAGEN + 2];
+    while ((d = readdir(dir)) != NULL) {
+        if (strncmp(d->d_name, PREFIJO_DIARIO, strlen(PREFIJO_DIARIO)) != 0) continue;
+        snprintf(ruta, sizeof(ruta), "%s/%s", st->outputDir, d->d_name);
+        FILE *f = fopen(ruta, "r");
+        if (!f) continue;
+        while (fgets(linea, sizeof(linea), f)) {
+            size_t n = strlen(linea);
+            if (n == 0 || linea[n - 1] != '\n') continue; // cut short by a crash
+            linea[n - 1] = '\0';
+            const int *i = bsearch(linea, porNombre, m->n, sizeof(int), buscarNombre);
+            if (i) anotadas[*i] = 1;
+        }
+        fclose(f);
+    }
+    closedir(dir);
+
+    // Only this rank's contiguous slice is stat'ed, as in construirManifiesto
+    int ini = (int)((long long)m->n * st->rank / numRanks), fin = (int)((long long)m->n * (st->rank + 1) / numRanks);
+    for (int i = ini; i < fin; i++) {
+        if (anotadas[i]) completas[i] = (char)salidasCompletas(st, i);
+    }
+    free(porNombre);
+    free(anotadas);
+}
+
+// --------- Result cache ---------
+
+// Cache tag of file j (as in rutaArchivo): derived only from the options
+// that change its bytes, see OpcionesSalida
+static void etiquetaCache(const EstadoRank *st, int j, char etiqueta[MAX_ETIQUETA_CACHE]) {
+    int numRutas = NUM_SALIDAS + st->kernels.n - 1;
+    OpcionesSalida o;
+    opcionesSalida(j < numRutas ? j : j - numRutas, j >= numRutas, &st->kernels, &o);
+    describirOpcionesSalida(&o, etiqueta, MAX_ETIQUETA_CACHE);
+}
+
+static int todasEnCache(const EstadoRank *st, const HashContenido *hash) {
+    char etiqueta[MAX_ETIQUETA_CACHE];
+    for (int j = 0; j < archivosPorImagen(st); j++) {
+        etiquetaCache(st, j, etiqueta);
+        if (!enCache(st->cache, hash, etiqueta)) return 0;
+    }
+    return 1;
+}
+
+// Only whole images are served: the filters share one read, so recomputing
+// some outputs costs about as much as recomputing all of them
+static int servirImagen(EstadoRank *st, const RutasImagen *r, const HashContenido *hash) {
+    int archivos = archivosPorImagen(st);
+    char etiqueta[MAX_ETIQUETA_CACHE];
+    int servidas = 0;
+    if (todasEnCache(st, hash)) {
+        for (; servidas < archivos; servidas++) {
+            etiquetaCache(st, servidas, etiqueta);
+            if (servirDeCache(st->cache, hash, etiqueta, rutaArchivo(st, r, servidas)) != 0) break;
+        }
+    }
+    if (servidas == archivos) return 1;
+    st->cache->fallos += archivos - servidas; // evicted meanwhile: computed below
+    return 0;
+}
+
+static void guardarImagen(Cache *cache, const EstadoRank *st, const RutasImagen *r, const HashContenido *hash) {
+    char etiqueta[MAX_ETIQUETA_CACHE];
+    for (int j = 0; j < archivosPorImagen(st); j++) {
+        etiquetaCache(st, j, etiqueta);
+        guardarEnCache(cache, hash, etiqueta, rutaArchivo(st, r, j));
+    }
+}
+
+static void informarProgreso(const EstadoRank *st, int i) {
+    if (st->progreso) avanzarProgreso(st->progreso, st->manifiesto->entradas[i].bytes);
+}
+
+// Images whose in-memory working set exceeds the budget are streamed in strips
+static int usarFranjas(const EstadoRank *st, int i) {
+    const EntradaManifiesto *e = &st->manifiesto->entradas[i];
+    return st->presupuesto > 0 && memoriaImagenCompleta(e->ancho, e->alto) > st->presupuesto;
+}
+
+void procesarImagen(EstadoRank *st, int i) {
+    double t0 = MPI_Wtime();
+    RutasImagen rutas;
+    armarRutas(st, i, &rutas);
+
+    // Una sola lectura de la imagen para todas las salidas
+    const char *salidas[MAX_RUTAS_SALIDA];
+    for (int s = 0; s < NUM_SALIDAS + st->kernels.n - 1; s++) salidas[s] = rutas.salidas[s];
+
+    // Byte-identical inputs under another name are served from the cache
+    HashContenido hash;
+    int conHash = st->cache && hashArchivo(st->cache, rutas.entrada, omp_get_max_threads(), &hash) == 0;
+    int servida = conHash && servirImagen(st, &rutas, &hash);
+
+    unsigned long lecturas = 0, escrituras = 0, lecturasBlur = 0;
+    int completa;
+    if (servida) {
+        completa = 1;
+        st->imagenesCache++;
+    } else if (usarFranjas(st, i)) {
+        completa = procesarImagenPorFranjas(rutas.entrada, salidas, &st->kernels, st->presupuesto, st->log,
+                                            &lecturas, &lecturasBlur, &escrituras, st->arena) == 0;
+        st->imagenesFranjas++;
+    } else {
+        completa = procesarImagenCompleta(rutas.entrada, salidas, &st->kernels, st->log, &lecturas, &lecturasBlur,
+                                          &escrituras, st->arena) == 0;
+    }
+    if (completa && conHash && !servida) guardarImagen(st->cache, st, &rutas, &hash);
+    if (completa) anotarDiario(st->diario, st->manifiesto->entradas[i].nombre);
+    if (st->presupuesto > 0) recortarArena(st->arena, st->presupuesto);
+
+    st->lecturas     += lecturas;
+    st->lecturasBlur += (unsigned long long)lecturasBlur * lecturasPorPixelBlur(&st->kernels);
+    st->escrituras   += escrituras;
+    st->imagenes++;
+    double segundos = MPI_Wtime() - t0;
+    st->tiempoOcupado += segundos;
+    if (st->latencias) registrarImagenLatencia(st->latencias, i, segundos);
+
+    informarProgreso(st, i);
+}
+
+// --------- Work sources ---------
+
+// Answers pending work requests; with bloquear, waits for at least one
+static void atenderPeticiones(Despachador *d, int bloquear) {
+    for (;;) {
+        int hay = 0;
+        MPI_Status status;
+        if (bloquear) {
+            MPI_Probe(MPI_ANY_SOURCE, TAG_PEDIR_TRABAJO, MPI_COMM_WORLD, &status);
+            hay = 1;
+            bloquear = 0;
+        } else {
+            MPI_Iprobe(MPI_ANY_SOURCE, TAG_PEDIR_TRABAJO, MPI_COMM_WORLD, &hay, &status);
+        }
+        if (!hay) return;
+
+        int peticion;
+        MPI_Recv(&peticion, 1, MPI_INT, status.MPI_SOURCE, TAG_PEDIR_TRABAJO, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+
+        int asignacion[2] = { d->siguiente, 0 };
+        if (d->siguiente < d->total) {
+            asignacion[1] = d->total - d->siguiente < d->chunk ? d->total - d->siguiente : d->chunk;
+            d->siguiente += asignacion[1];
+        } else {
+            d->trabajadoresActivos--;
+        }
+        MPI_Send(asignacion, 2, MPI_INT, status.MPI_SOURCE, TAG_ASIGNACION, MPI_COMM_WORLD);
+    }
+}
+
+// Static mode: longest-processing-time-first split of the manifest; every
+// rank computes the same assignment locally.
+// Dynamic mode: rank 0 hands out chunks of images on request, most expensive
+// first, and takes its own chunks in between, answering requests before every
+// image. With prefetch, workers ask for their next chunk as soon as they
+// receive the current one, so the reply is already there when they finish.
+void iniciarFuente(FuenteTrabajo *f, EstadoRank *st, int size, int dinamico, int chunk, int prefetch) {
+    memset(f, 0, sizeof(*f));
+    f->dinamico = dinamico;
+    f->prefetch = prefetch;
+    if (!dinamico) {
+        f->propias = asignarLPT(st->manifiesto, &st->kernels, size, st->rank, &f->cuantas);
+        return;
+    }
+    if (st->rank == 0) {
+        f->d.siguiente = 0;
+        f->d.total = st->total;
+        f->d.chunk = chunk;
+        f->d.trabajadoresActivos = size - 1;
+    }
+}
+
+int siguienteImagen(FuenteTrabajo *f, EstadoRank *st) {
+    if (!f->dinamico) {
+        return f->actual < f->cuantas ? f->propias[f->actual++] : -1;
+    }
+
+    if (st->rank == 0) {
+        atenderPeticiones(&f->d, 0);
+        if (f->actual >= f->fin) {
+            if (f->d.siguiente >= f->d.total) return -1;
+            f->actual = f->d.siguiente;
+            f->fin = f->actual + (f->d.total - f->actual < f->d.chunk ? f->d.total - f->actual : f->d.chunk);
+            f->d.siguiente = f->fin;
+        }
+        return st->orden[f->actual++];
+    }
+
+    if (f->actual < f->fin) return st->orden[f->actual++];
+    if (f->agotada) return -1;
+
+    double t0 = MPI_Wtime();
+    if (f->pendiente) {
+        MPI_Waitall(2, f->reqs, MPI_STATUSES_IGNORE);
+        f->pendiente = 0;
+    } else {
+        MPI_Send(&f->peticion, 1, MPI_INT, 0, TAG_PEDIR_TRABAJO, MPI_COMM_WORLD);
+        MPI_Recv(f->siguiente, 2, MPI_INT, 0, TAG_ASIGNACION, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+    }
+    st->tiempoEspera += MPI_Wtime() - t0;
+
+    f->actual = f->siguiente[0];
+    f->fin = f->siguiente[0] + f->siguiente[1];
+    if (f->siguiente[1] == 0) {
+        f->agotada = 1;
+        return -1;
+    }
+    if (f->prefetch) {
+        MPI_Irecv(f->siguiente, 2, MPI_INT, 0, TAG_ASIGNACION, MPI_COMM_WORLD, &f->reqs[1]);
+        MPI_Isend(&f->peticion, 1, MPI_INT, 0, TAG_PEDIR_TRABAJO, MPI_COMM_WORLD, &f->reqs[0]);
+        f->pendiente = 1;
+    }
+    return st->orden[f->actual++];
+}
+
+void terminarFuente(FuenteTrabajo *f, EstadoRank *st) {
+    if (f->dinamico && st->rank == 0) {
+        // With the progress stream on, poll both queues so the lines keep
+        // coming while the workers finish their last chunks
+        struct timespec espera = { 0, 1000 * 1000 };
+        while (f->d.trabajadoresActivos > 0) {
+            if (!st->progreso) {
+                atenderPeticiones(&f->d, 1);
+                continue;
+            }
+            atenderPeticiones(&f->d, 0);
+            atenderProgreso(st->progreso);
+            if (f->d.trabajadoresActivos > 0) nanosleep(&espera, NULL);
+        }
+    }
+    free(f->propias);
+    f->propias = NULL;
+}
+
+void ejecutarLote(EstadoRank *st, FuenteTrabajo *f) {
+    int i;
+    while ((i = siguienteImagen(f, st)) >= 0) {
+        procesarImagen(st, i);
+    }
+    terminarFuente(f, st);
+}
+
+// --------- Read / compute / write pipeline ---------
+
+// A slot goes LIBRE -> ASIGNADA (main) -> LEIDA (reader) -> ESCRIBIENDO (main)
+// -> LIBRE (writer). Slots are used round robin, so each stage only has to
+// follow the slots in order.
+typedef enum { RANURA_LIBRE, RANURA_ASIGNADA, RANURA_LEIDA, RANURA_ESCRIBIENDO } EstadoRanura;
+
+typedef struct {
+    EstadoRanura estado;
+    int indice;
+    RutasImagen rutas;
+    ImagenBMP img;
+    int leida;                 // leerImagenBMP succeeded
+    int franjas;               // streamed by the compute stage, never mapped
+    int completa;              // every output written; journaled once they are closed
+    int conHash;               // hash of the input, for the cache
+    HashContenido hash;
+    int enCache;               // reader found every output in the cache and skipped the read
+    int servida;               // compute served the outputs from the cache
+    unsigned long lecturas;
+    unsigned long escrituras;
+    SalidasPendientes pendientes;
+} Ranura;
+
+typedef struct {
+    Ranura *ranuras;
+    int n;
+    int asignadas;             // images handed to the pipeline so far
+    int agotada;               // the source has no more images
+    pthread_mutex_t mutex;
+    pthread_cond_t cambio;
+    FILE *log;
+    const Topologia *topologia;
+    const EstadoRank *st;
+    const Manifiesto *manifiesto;
+    int diario;
+    Cache *cache;
+    double tiempoLectura, tiempoEscritura;
+    unsigned long long escrituras;
+} Pipeline;
+
+// Waits until slot r reaches estado, or returns 0 if it never will
+static int esperarRanura(Pipeline *p, int r, EstadoRanura estado) {
+    Ranura *s = &p->ranuras[r % p->n];
+    pthread_mutex_lock(&p->mutex);
+    while (s->estado != estado && !(p->agotada && r >= p->asignadas)) {
+        pthread_cond_wait(&p->cambio, &p->mutex);
+    }
+    int ok = !(p->agotada && r >= p->asignadas);
+    pthread_mutex_unlock(&p->mutex);
+    return ok;
+}
+
+static void pasarRanura(Pipeline *p, Ranura *s, EstadoRanura estado) {
+    pthread_mutex_lock(&p->mutex);
+    s->estado = estado;
+    pthread_cond_broadcast(&p->cambio);
+    pthread_mutex_unlock(&p->mutex);
+}
+
+// Reader: maps each input and faults every page in, so compute never
+// stalls on the file system
+static void *hiloLector(void *arg) {
+    Pipeline *p = arg;
+    long pagina = sysconf(_SC_PAGESIZE);
+    atarHiloAlRank(p->topologia);
+    for (int r = 0; esperarRanura(p, r, RANURA_ASIGNADA); r++) {
+        Ranura *s = &p->ranuras[r % p->n];
+        double t0 = omp_get_wtime();
+        s->lecturas = 0;
+        // Hashed here, off the compute thread; a full hit needs no read at all
+        s->conHash = p->cache && hashArchivo(p->cache, s->rutas.entrada, 1, &s->hash) == 0;
+        s->enCache = s->conHash && todasEnCache(p->st, &s->hash);
+        s->leida = !s->franjas && !s->enCache && leerImagenBMP(s->rutas.entrada, &s->img, p->log, &s->lecturas) == 0;
+        if (s->leida) {
+            const volatile uint8_t *bytes = s->img.mapa;
+            uint8_t suma = 0;
+            for (size_t off = 0; off < s->img.tamMapa; off += pagina) suma += bytes[off];
+            (void)suma;
+        }
+        p->tiempoLectura += omp_get_wtime() - t0;
+        pasarRanura(p, s, RANURA_LEIDA);
+    }
+    return NULL;
+}
+
+// Writer: unmaps and closes the outputs left open by the compute stage and
+// releases the input
+static void *hiloEscritor(void *arg) {
+    Pipeline *p = arg;
+    atarHiloAlRank(p->topologia);
+    for (int r = 0; esperarRanura(p, r, RANURA_ESCRIBIENDO); r++) {
+        Ranura *s = &p->ranuras[r % p->n];
+        double t0 = omp_get_wtime();
+        for (int k = 0; k < s->pendientes.n; k++) {
+            if (cerrarSalidaBMP(&s->pendientes.salidas[k], &s->escrituras) != 0) s->completa = 0;
+        }
+        s->pendientes.n = 0;
+        if (s->completa && s->conHash && !s->servida) guardarImagen(p->cache, p->st, &s->rutas, &s->hash);
+        if (s->completa) anotarDiario(p->diario, p->manifiesto->entradas[s->indice].nombre);
+        if (s->leida) liberarImagenBMP(&s->img);
+        p->escrituras += s->escrituras;
+        p->tiempoEscritura += omp_get_wtime() - t0;
+        pasarRanura(p, s, RANURA_LIBRE);
+    }
+    return NULL;
+}
+
+// Hands manifest entry i to the next slot; returns 0 once the source is dry
+static int asignarSiguiente(Pipeline *p, EstadoRank *st, FuenteTrabajo *f) {
+    int i = siguienteImagen(f, st);
+    if (i < 0) {
+        pthread_mutex_lock(&p->mutex);
+        p->agotada = 1;
+        pthread_cond_broadcast(&p->cambio);
+        pthread_mutex_unlock(&p->mutex);
+        return 0;
+    }
+
+    Ranura *s = &p->ranuras[p->asignadas % p->n];
+    double t0 = omp_get_wtime();
+    pthread_mutex_lock(&p->mutex);
+    while (s->estado != RANURA_LIBRE) pthread_cond_wait(&p->cambio, &p->mutex);
+    pthread_mutex_unlock(&p->mutex);
+    st->esperaEscritura += omp_get_wtime() - t0;
+
+    s->indice = i;
+    s->franjas = usarFranjas(st, i);
+    armarRutas(st, i, &s->rutas);
+    s->escrituras = 0;
+    s->completa = 0;
+    s->servida = 0;
+    s->pendientes.n = 0;
+    pthread_mutex_lock(&p->mutex);
+    s->estado = RANURA_ASIGNADA;
+    p->asignadas++;
+    pthread_cond_broadcast(&p->cambio);
+    pthread_mutex_unlock(&p->mutex);
+    return 1;
+}
+
+// The main thread only computes (and talks MPI); up to enVuelo - 1 inputs are
+// read ahead while the outputs of finished images are flushed behind it
+void ejecutarLotePipeline(EstadoRank *st, FuenteTrabajo *f, int enVuelo) {
+    if (enVuelo < 2) enVuelo = 2;
+    Pipeline p;
+    memset(&p, 0, sizeof(p));
+    p.ranuras = calloc(enVuelo, sizeof(Ranura));
+    if (!p.ranuras) {
+        ejecutarLote(st, f);
+        return;
+    }
+    p.n = enVuelo;
+    p.log = st->log;
+    p.topologia = st->topologia;
+    p.st = st;
+    p.manifiesto = st->manifiesto;
+    p.diario = st->diario;
+    p.cache = st->cache;
+    pthread_mutex_init(&p.mutex, NULL);
+    pthread_cond_init(&p.cambio, NULL);
+
+    pthread_t lector, escritor;
+    pthread_create(&lector, NULL, hiloLector, &p);
+    pthread_create(&escritor, NULL, hiloEscritor, &p);
+
+    int hayMas = 1;
+    for (int r = 0; r < enVuelo - 1 && hayMas; r++) {
+        hayMas = asignarSiguiente(&p, st, f);
+    }
+
+    for (int c = 0; c < p.asignadas; c++) {
+        Ranura *s = &p.ranuras[c % p.n];
+        double t0 = omp_get_wtime();
+        esperarRanura(&p, c, RANURA_LEIDA);
+        double t1 = omp_get_wtime();
+        st->esperaLectura += t1 - t0;
+
+        const char *salidas[MAX_RUTAS_SALIDA];
+        for (int k = 0; k < NUM_SALIDAS + st->kernels.n - 1; k++) salidas[k] = s->rutas.salidas[k];
+        if (s->conHash && !s->enCache) st->cache->fallos += archivosPorImagen(st);
+        s->servida = s->enCache && servirImagen(st, &s->rutas, &s->hash);
+        if (s->enCache && !s->servida && !s->franjas) {
+            s->leida = leerImagenBMP(s->rutas.entrada, &s->img, st->log, &s->lecturas) == 0;
+        }
+        if (s->servida) {
+            s->completa = 1;
+            st->imagenesCache++;
+        } else if (s->franjas) {
+            unsigned long lecturasBlur = 0;
+            s->completa = procesarImagenPorFranjas(s->rutas.entrada, salidas, &st->kernels, st->presupuesto, st->log,
+                                                   &s->lecturas, &lecturasBlur, &s->escrituras, st->arena) == 0;
+            st->imagenesFranjas++;
+        } else if (s->leida) {
+            s->completa = procesarImagenBMP(&s->img, salidas, &st->kernels, st->log, &s->escrituras, &s->pendientes,
+                                            st->arena) == 0;
+        }
+        if (st->presupuesto > 0) recortarArena(st->arena, st->presupuesto);
+        st->lecturas     += s->lecturas;
+        st->lecturasBlur += (unsigned long long)s->lecturas * lecturasPorPixelBlur(&st->kernels);
+        st->imagenes++;
+        double segundos = omp_get_wtime() - t1;
+        st->tiempoOcupado += segundos;
+        int indice = s->indice;
+        if (st->latencias) registrarImagenLatencia(st->latencias, indice, segundos);
+        pasarRanura(&p, s, RANURA_ESCRIBIENDO);
+        informarProgreso(st, indice);
+
+        if (hayMas) hayMas = asignarSiguiente(&p, st, f);
+    }
+
+    terminarFuente(f, st);
+    pthread_join(lector, NULL);
+    pthread_join(escritor, NULL);
+
+    st->escrituras      += p.escrituras;
+    st->tiempoLectura   += p.tiempoLectura;
+    st->tiempoEscritura += p.tiempoEscritura;
+    pthread_cond_destroy(&p.cambio);
+    pthread_mutex_destroy(&p.mutex);
+    free(p.ranuras);
+}
@@ -0,0 +1,102 @@
+// lote.h
+#ifndef LOTE_H
+#define LOTE_H
+
+#include "cache.h"
+#include "image_processing.h"
+#include "latencias.h"
+#include "manifiesto.h"
+#include "previas.h"
+#include "progreso.h"
+#include "topologia.h"
+#include <mpi.h>
+#include <stdio.h>
+
+#define TAG_PEDIR_TRABAJO 1 // worker -> rank 0: request the next chunk
+#define TAG_ASIGNACION    2 // rank 0 -> worker: {first position, count}; count 0 = no more work
+
+// Per-rank journal in the output directory: one image name per line, appended
+// once every output of that image is closed
+#define PREFIJO_DIARIO ".diario_rank"
+
+// Per-rank state and counters for the batch
+typedef struct {
+    const char *imagesDir;
+    const char *outputDir;
+    ListaKernels kernels;  // one _blur_k output per kernel
+    const Manifiesto *manifiesto;
+    const int *orden;      // manifest indices from most to least expensive
+    int total;
+    int rank;
+    const Topologia *topologia; // cores of this rank, for the pipeline threads
+    FILE *log;
+    size_t presupuesto;    // working memory per image in bytes; 0 = unbounded
+    Arena *arena;          // work buffers reused across this rank's images
+    Latencias *latencias;  // per-filter and per-image latencies; NULL = not recorded
+    int diario;            // descriptor of this rank's journal; -1 = none
+    Cache *cache;          // content-addressed result cache; NULL = off
+    Progreso *progreso;    // progress stream to rank 0; NULL = off
+    unsigned long long lecturas, lecturasBlur, escrituras;
+    int imagenes;          // images processed by this rank
+    int imagenesFranjas;   // of those, streamed in strips to fit presupuesto
+    int imagenesCache;     // of those, served whole from the cache
+    double tiempoOcupado;  // seconds spent processing images (compute only with the pipeline)
+    double tiempoEspera;   // seconds waiting for work assignments
+    // Pipeline stages (zero without --pipeline)
+    double tiempoLectura;   // reader thread busy reading inputs
+    double tiempoEscritura; // writer thread busy flushing outputs
+    double esperaLectura;   // compute stalled waiting for an input
+    double esperaEscritura; // compute stalled waiting for a free slot
+} EstadoRank;
+
+// Work queue kept by rank 0 in dynamic mode
+typedef struct {
+    int siguiente;         // next position of the cost order not yet handed out
+    int total;
+    int chunk;
+    int trabajadoresActivos; // workers not yet told there is no more work
+} Despachador;
+
+// Source of manifest indices for one rank, static (LPT) or dynamic
+typedef struct {
+    int dinamico;
+    int prefetch;
+    // Static: own LPT list
+    int *propias;
+    int cuantas;
+    // Dynamic: current chunk of positions in st->orden
+    int actual, fin;
+    Despachador d;         // rank 0 only
+    int agotada;           // worker: rank 0 said there is no more work
+    int pendiente;         // worker: a prefetched request is in flight
+    int peticion, siguiente[2];
+    MPI_Request reqs[2];   // worker: the prefetched request
+} FuenteTrabajo;
+
+void iniciarFuente(FuenteTrabajo *f, EstadoRank *st, int size, int dinamico, int chunk, int prefetch);
+// Next manifest index for this rank, or -1 when there is no more work
+int siguienteImagen(FuenteTrabajo *f, EstadoRank *st);
+// Rank 0 keeps answering requests until every worker is done
+void terminarFuente(FuenteTrabajo *f, EstadoRank *st);
+
+// Removes every journal left in outputDir; one rank per node, before abrirDiario
+void borrarDiarios(const char *outputDir);
+// Opens this rank's journal for appending; -1 if it could not be created
+int abrirDiario(EstadoRank *st);
+void cerrarDiario(EstadoRank *st);
+// Sets completas[i] for the manifest entries listed in any journal of
+// outputDir whose outputs all exist, are not older than the input and, for
+// BMP outputs, have the expected size. Only the slice of the manifest owned
+// by st->rank out of numRanks is checked; the caller merges the slices.
+void buscarCompletas(const EstadoRank *st, int numRanks, char *completas);
+
+// Reads manifest entry i once and writes its outputs, accumulating the counters
+void procesarImagen(EstadoRank *st, int i);
+// Processes every image from the source, one after another
+void ejecutarLote(EstadoRank *st, FuenteTrabajo *f);
+// Same, overlapping the read of the next images and the flush of the
+// previous ones with the compute of the current one; enVuelo >= 2 slots
+#define MAX_RANURAS_PIPELINE 64 // bound for --pipeline=N
+void ejecutarLotePipeline(EstadoRank *st, FuenteTrabajo *f, int enVuelo);
+
+#endif // LOTE_H
@@ -1,5 +1,12 @@
 // main.c
 #include "image_processing.h"
+#include "manifiesto.h"
+#include "lote.h"
+#include "topologia.h"
+#include "contadores.h"
+#include "latencias.h"
+#include "previas.h"
+#include "progreso.h"
 #include <mpi.h>
 #include <omp.h>
 #include <stdio.h>
@@ -7,36 +14,172 @@
 #include <string.h>
 #include <time.h>
 #include <locale.h>
-#include <dirent.h>
+#include <errno.h>
+#include <limits.h>
+#include <math.h>
+#include <sys/resource.h>
 #include <sys/stat.h>
 #include <sys/statvfs.h>
 #include <unistd.h>
 
-#define NUM_THREADS 6 // Per process/thread
-#define MAX_HOSTNAME 256
 
 void formatNumberWithCommas(const char *numStr, char *buffer);
 long long get_free_space_bytes(const char *path);
-long long calcular_promedio_tamano_imagenes(const char *directorio, int *num_imagenes);
+
+// Exact option name match: the text after "=" ("" if there is none), or NULL
+// when arg is another option (so "--previasx" is not "--previas")
+static const char *valorOpcion(const char *arg, const char *nombre) {
+    size_t n = strlen(nombre);
+    if (strncmp(arg, nombre, n) != 0) return NULL;
+    if (arg[n] == '\0') return arg + n;
+    return arg[n] == '=' ? arg + n + 1 : NULL;
+}
+
+// Whole option value in [minimo, maximo]; 0 on empty text, trailing junk or
+// out of range, so "--hilos=foo" is rejected instead of becoming 0
+static int enteroOpcion(const char *v, long minimo, long maximo, long *valor) {
+    char *fin;
+    errno = 0;
+    long x = strtol(v, &fin, 10);
+    if (fin == v || *fin != '\0' || errno == ERANGE || x < minimo || x > maximo) return 0;
+    *valor = x;
+    return 1;
+}
+
+// Same for a finite real >= minimo
+static int realOpcion(const char *v, double minimo, double *valor) {
+    char *fin;
+    errno = 0;
+    double x = strtod(v, &fin);
+    if (fin == v || *fin != '\0' || errno == ERANGE || !isfinite(x) || x < minimo) return 0;
+    *valor = x;
+    return 1;
+}
+
+static void imprimirUso(const char *programa) {
+    fprintf(stderr,
+            "Uso: %s <kernel[,kernel...]> <dirEntrada> <dirSalida> [maxImagenes] [opciones]\n"
+            "Opciones: --desenfoque=integral|separable --dinamico[=N] --prefetch --pipeline[=N]\n"
+            "          --hilos=N --sin-afinidad --contadores --memoria=MB --hugepages\n"
+            "          --grises=8bits|24bits --sigma=S --salida=bmp|qoi --volteo=mapeado|sincopia|topdown\n"
+            "          --reanudar --cache=DIR --cache-limite=MB --progreso=S --previas[=LADO]\n",
+            programa);
+}
 
 int main(int argc, char *argv[]) {
     // --------- Argument parsing ---------
     int num_imagenes_total = 600;           // default total images
     char *imagesDir      = "./images_test";    // default input folder
     char *outputDir      = "./processed_test"; // default output folder
-    int  kernelSize      = 155;            // default kernel size
+    ListaKernels kernels = { 1, { 155 } }; // default kernel size; "55,105,155" sweeps several
+    int  dinamico        = 0;              // 1 = rank 0 hands out chunks on request
+    int  chunk           = 1;              // images per assignment in dynamic mode
+    int  prefetch        = 0;              // 1 = request the next chunk while processing
+    int  enVuelo         = 0;              // pipeline slots; 0 = read, compute and write in turn
+    long memoriaMB       = 0;              // working memory budget per image; 0 = unbounded
+    int  hugepages       = 0;              // 1 = back the buffer pool with 2 MB pages
+    int  hilosPedidos    = 0;              // OpenMP threads per rank; 0 = node CPUs / ranks on the node
+    int  atarHilos       = 1;              // 1 = pin each OpenMP thread to one core of the rank's block
+    int  medirContadores = 0;              // 1 = hardware counters around every filter
+    int  reanudar        = 0;              // 1 = skip images a previous run already finished
+    char *cacheDir       = NULL;           // content-addressed result cache; NULL = off
+    long cacheMB         = 4096;           // cache size bound, least recently used evicted first
+    double intervaloProgreso = 1.0;        // seconds between progress lines on stdout; 0 = off
 
-    if (argc >= 4) {
-        kernelSize         = atoi(argv[1]); // odd between 3 and 155
-        imagesDir          = argv[2];       // input directory
-        outputDir          = argv[3];       // output directory
+    // Options start with "--" and may appear anywhere; the rest are positional.
+    // Unknown options, or known ones with a missing or bad value, stop with
+    // the usage message instead of being ignored.
+    char *posicionales[4];
+    int numPosicionales = 0;
+    for (int a = 1; a < argc; a++) {
+        const char *v;
+        long n;
+        double x;
+        int valida = 1;
+        if (strncmp(argv[a], "--", 2) != 0) {
+            if (numPosicionales < 4) posicionales[numPosicionales++] = argv[a];
+        } else if (strcmp(argv[a], "--desenfoque=separable") == 0) {
+            establecerMetodoDesenfoque(DESENFOQUE_SEPARABLE);
+        } else if (strcmp(argv[a], "--desenfoque=integral") == 0) {
+            establecerMetodoDesenfoque(DESENFOQUE_INTEGRAL);
+        } else if ((v = valorOpcion(argv[a], "--dinamico"))) {
+            dinamico = 1;
+            if (*v && (valida = enteroOpcion(v, 1, INT_MAX, &n))) chunk = (int)n;
+        } else if (strcmp(argv[a], "--prefetch") == 0) {
+            prefetch = 1;
+        } else if ((v = valorOpcion(argv[a], "--pipeline"))) {
+            enVuelo = 3;
+            if (*v && (valida = enteroOpcion(v, 2, MAX_RANURAS_PIPELINE, &n))) enVuelo = (int)n;
+        } else if ((v = valorOpcion(argv[a], "--hilos"))) {
+            if ((valida = enteroOpcion(v, 0, MAX_HILOS_RANK, &n))) hilosPedidos = (int)n;
+        } else if (strcmp(argv[a], "--contadores") == 0) {
+            medirContadores = 1;
+        } else if (strcmp(argv[a], "--sin-afinidad") == 0) {
+            atarHilos = 0;
+        } else if ((v = valorOpcion(argv[a], "--cache"))) {
+            if ((valida = *v != '\0')) cacheDir = (char *)v;
+        } else if ((v = valorOpcion(argv[a], "--cache-limite"))) {
+            if ((valida = enteroOpcion(v, 0, LONG_MAX >> 20, &n))) cacheMB = n;
+        } else if ((v = valorOpcion(argv[a], "--progreso"))) {
+            if ((valida = realOpcion(v, 0.0, &x))) intervaloProgreso = x;
+        } else if ((v = valorOpcion(argv[a], "--previas"))) {
+            n = LADO_PREVIA;
+            if (!*v || (valida = enteroOpcion(v, 1, MAX_LADO_PREVIA, &n))) establecerLadoPrevias((int)n);
+        } else if (strcmp(argv[a], "--reanudar") == 0) {
+            reanudar = 1;
+        } else if (strcmp(argv[a], "--hugepages") == 0) {
+            hugepages = 1;
+        } else if ((v = valorOpcion(argv[a], "--memoria"))) {
+            if ((valida = enteroOpcion(v, 0, LONG_MAX >> 20, &n))) memoriaMB = n;
+        } else if (strcmp(argv[a], "--grises=8bits") == 0) {
+            establecerFormatoGrises(GRISES_8BITS);
+        } else if (strcmp(argv[a], "--grises=24bits") == 0) {
+            establecerFormatoGrises(GRISES_24BITS);
+        } else if ((v = valorOpcion(argv[a], "--sigma"))) {
+            if ((valida = realOpcion(v, 0.0, &x))) establecerSigmaGauss(x); // 0 keeps the one derived from the kernel
+        } else if (strcmp(argv[a], "--salida=qoi") == 0) {
+            establecerFormatoArchivo(ARCHIVO_QOI);
+        } else if (strcmp(argv[a], "--salida=bmp") == 0) {
+            establecerFormatoArchivo(ARCHIVO_BMP);
+        } else if (strcmp(argv[a], "--volteo=mapeado") == 0) {
+            establecerModoVolteoVertical(VOLTEO_MAPEADO);
+        } else if (strcmp(argv[a], "--volteo=sincopia") == 0) {
+            establecerModoVolteoVertical(VOLTEO_SIN_COPIA);
+        } else if (strcmp(argv[a], "--volteo=topdown") == 0) {
+            establecerModoVolteoVertical(VOLTEO_TOPDOWN);
+        } else {
+            valida = 0;
+        }
+        if (!valida) {
+            fprintf(stderr, "Opción desconocida o con valor inválido: %s\n", argv[a]);
+            imprimirUso(argv[0]);
+            return 1;
+        }
+    }
+
+    if (numPosicionales >= 3) {
+        if (parsearKernels(posicionales[0], &kernels) != 0) { // odd between 3 and 155, comma-separated
+            fprintf(stderr, "Kernels inválidos: %s (hasta %d tamaños impares entre %d y %d separados por comas)\n",
+                    posicionales[0], MAX_KERNELS, KERNEL_MINIMO, KERNEL_MAXIMO);
+            return 1;
+        }
+        imagesDir          = posicionales[1];       // input directory
+        outputDir          = posicionales[2];       // output directory
     }
-    if (argc >= 5) {
-        num_imagenes_total = atoi(argv[4]); // optional override total count
+    if (numPosicionales >= 4) {
+        long n;
+        if (!enteroOpcion(posicionales[3], 0, INT_MAX, &n)) { // optional override total count
+            fprintf(stderr, "Cantidad de imágenes inválida: %s\n", posicionales[3]);
+            imprimirUso(argv[0]);
+            return 1;
+        }
+        num_imagenes_total = (int)n;
     }
 
     // Initialize MPI and threading
-    MPI_Init(&argc, &argv);
+    // Only the main thread calls MPI; the pipeline threads do file I/O
+    int nivelHilos;
+    MPI_Init_thread(&argc, &argv, MPI_THREAD_FUNNELED, &nivelHilos);
     int rank, size;
     MPI_Comm_rank(MPI_COMM_WORLD, &rank);
     MPI_Comm_size(MPI_COMM_WORLD, &size);
@@ -45,7 +188,6 @@ int main(int argc, char *argv[]) {
     setvbuf(stderr, NULL, _IONBF, 0);
 
     setlocale(LC_NUMERIC, "C");
-    omp_set_num_threads(NUM_THREADS);
 
     // Open log file for all ranks
     FILE *log = fopen("log_temp.txt", "w");
@@ -54,42 +196,87 @@ int main(int argc, char *argv[]) {
         MPI_Abort(MPI_COMM_WORLD, 1);
     }
 
-    // Split by hostname for local gathers
+    // Split by hostname for local gathers and to share the node's cores
     char hostname[MAX_HOSTNAME];
-    gethostname(hostname, MAX_HOSTNAME);
-    unsigned long host_hash = 5381;
-    for (int c = 0; hostname[c] != '\0'; c++)
-        host_hash = ((host_hash << 5) + host_hash) + hostname[c];
-    MPI_Comm node_comm;
-    MPI_Comm_split(MPI_COMM_WORLD, host_hash, rank, &node_comm);
+    MPI_Comm node_comm = dividirPorNodo(MPI_COMM_WORLD, hostname);
     int node_rank;
     MPI_Comm_rank(node_comm, &node_rank);
+    Topologia topologia;
+    configurarTopologia(node_comm, hilosPedidos, atarHilos, &topologia);
 
-    // --------- Compute average size ---------
-    long long promedioTamano = 0;
-    int numImagenesReal = 0;
-    if (rank == 0) {
-        promedioTamano = calcular_promedio_tamano_imagenes(imagesDir, &numImagenesReal);
-        if (promedioTamano <= 0 || numImagenesReal == 0) {
-            fprintf(stderr, "No se pudo calcular el tamaño promedio.\n");
-            MPI_Abort(MPI_COMM_WORLD, 1);
-        }
+    // --------- Build the image manifest ---------
+    Manifiesto manifiesto;
+    int estadoManifiesto = construirManifiesto(imagesDir, num_imagenes_total, MPI_COMM_WORLD, &manifiesto);
+    if (estadoManifiesto == MANIFIESTO_SIN_MEMORIA) {
+        if (rank == 0) fprintf(stderr, "Memoria insuficiente para listar %s.\n", imagesDir);
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    } else if (estadoManifiesto != 0) {
+        if (rank == 0) fprintf(stderr, "No se encontraron imágenes BMP de 24 bits en %s.\n", imagesDir);
+        MPI_Abort(MPI_COMM_WORLD, 1);
     }
-    MPI_Bcast(&promedioTamano, 1, MPI_LONG_LONG, 0, MPI_COMM_WORLD);
-
-    // --------- Broadcast kernel size ---------
-    MPI_Bcast(&kernelSize, 1, MPI_INT, 0, MPI_COMM_WORLD);
+    if (rank == 0 && manifiesto.descartadas > 0) {
+        fprintf(stderr, "Se ignoran %d archivos .bmp que no son BMP de 24 bits válidos o están truncados.\n", manifiesto.descartadas);
+    }
+    num_imagenes_total = manifiesto.n;
 
-    // --------- Divide work ---------
-    int imagesPerProc = num_imagenes_total / size;
-    int start = rank * imagesPerProc + 1;
-    int end   = (rank == size - 1) ? num_imagenes_total : start + imagesPerProc - 1;
+    // --------- Broadcast kernel sizes ---------
+    MPI_Bcast(&kernels, sizeof(kernels) / sizeof(int), MPI_INT, 0, MPI_COMM_WORLD);
 
     // Create output directory
     mkdir(outputDir, 0777);
+    if (obtenerLadoPrevias() > 0) {
+        char dirPrevias[1024];
+        snprintf(dirPrevias, sizeof(dirPrevias), "%s/%s", outputDir, DIR_PREVIAS);
+        mkdir(dirPrevias, 0777);
+    }
+
+    // --------- Resume ---------
+    // The journals in the output directory list the images whose outputs were
+    // all closed. --reanudar skips those whose outputs are still whole and
+    // balances only the rest; otherwise the journals are cleared so they only
+    // describe this run. Each rank checks one slice of the images, so the sets
+    // are merged.
+    EstadoRank st;
+    memset(&st, 0, sizeof(st));
+    st.imagesDir  = imagesDir;
+    st.outputDir  = outputDir;
+    st.kernels    = kernels;
+    st.manifiesto = &manifiesto;
+    st.rank       = rank;
+    st.diario     = -1;
+    Cache cache;
+    if (cacheDir) {
+        if (abrirCache(&cache, cacheDir, (long long)cacheMB << 20) == 0) {
+            st.cache = &cache;
+            if (node_rank == 0) recortarCache(&cache);
+        } else if (rank == 0) {
+            fprintf(stderr, "No se pudo usar la cache en %s; se procesa sin ella\n", cacheDir);
+        }
+    }
+    char *completas = calloc(manifiesto.n, 1);
+    if (reanudar) {
+        buscarCompletas(&st, size, completas);
+        MPI_Allreduce(MPI_IN_PLACE, completas, manifiesto.n, MPI_UNSIGNED_CHAR, MPI_MAX, MPI_COMM_WORLD);
+    } else if (node_rank == 0) {
+        borrarDiarios(outputDir);
+    }
+    MPI_Barrier(MPI_COMM_WORLD);
+    Manifiesto pendientes;
+    if (filtrarManifiesto(&manifiesto, completas, &pendientes) != 0) {
+        if (rank == 0) fprintf(stderr, "Memoria insuficiente para el manifiesto.\n");
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+    free(completas);
+    int omitidas = manifiesto.n - pendientes.n;
+    num_imagenes_total = pendientes.n;
+    if (abrirDiario(&st) != 0) {
+        fprintf(stderr, "Rank %d: no se pudo abrir el diario en %s; --reanudar rehara sus imagenes\n", rank, outputDir);
+    }
+    if (rank == 0 && reanudar) {
+        printf("Reanudando: %d de %d imagenes ya estaban completas\n", omitidas, manifiesto.n);
+    }
 
     // --------- Check available space ---------
-    long long estimacionPorImagen = promedioTamano * 6;
     long long espacioLocal = 0;
     if (node_rank == 0) {
         espacioLocal = get_free_space_bytes(outputDir);
@@ -103,7 +290,11 @@ int main(int argc, char *argv[]) {
     if (rank == 0) {
         long long espacioTotal = 0;
         for (int i = 0; i < size; i++) espacioTotal += espaciosPorNodo[i];
-        long long espacioNecesario = estimacionPorImagen * num_imagenes_total * 1.08;
+        // With --salida=qoi the bound is the codec's worst case (raw bands plus
+        // the band table), since compression depends on content
+        int grises8 = obtenerFormatoGrises() == GRISES_8BITS ? NUM_SALIDAS_GRISES : 0;
+        long long espacioNecesario = espacioNecesarioManifiesto(&pendientes, NUM_SALIDAS - grises8 + kernels.n - 1,
+                                                                grises8, obtenerFormatoArchivo(), 4096);
         if (espacioTotal < espacioNecesario) {
             fprintf(stderr, "ERROR: Espacio insuficiente en el clúster. Requiere %.2f GB, disponible %.2f GB\n",
                     (double)espacioNecesario / (1024.0 * 1024.0 * 1024.0),
@@ -115,56 +306,126 @@ int main(int argc, char *argv[]) {
     }
 
     // --------- Processing loop ---------
-    unsigned long long totalLecturas     = 0;
-    unsigned long long totalLecturasBlur = 0;
-    unsigned long long totalEscrituras   = 0;
+    st.manifiesto = &pendientes;
+    st.total      = num_imagenes_total;
+    st.topologia  = &topologia;
+    st.log        = log;
+    st.presupuesto = (size_t)memoriaMB << 20;
+    Arena arena;
+    iniciarArena(&arena, hugepages);
+    st.arena      = &arena;
+    Latencias latencias;
+    iniciarLatencias(&latencias);
+    st.latencias  = &latencias;
+    Contadores contadores;
+    if (medirContadores) iniciarContadores(&contadores);
+    Progreso progreso;
+    if (intervaloProgreso > 0) {
+        if (iniciarProgreso(&progreso, &pendientes, intervaloProgreso) != 0) {
+            fprintf(stderr, "Memoria insuficiente para el progreso.\n");
+            MPI_Abort(MPI_COMM_WORLD, 1);
+        }
+        st.progreso = &progreso;
+    }
     double startTime = MPI_Wtime();
 
-    int localIndex = 1;
-    for (int i = start; i <= end; i++) {
-        char entrada[512], salida1[512], salida2[512], salida3[512];
-        char salida4[512], salida5[512], salida6[512];
-        snprintf(entrada, sizeof(entrada), "%s/img%d.bmp", imagesDir, i);
-        snprintf(salida1, sizeof(salida1), "%s/img%d_hg.bmp", outputDir, i);
-        snprintf(salida2, sizeof(salida2), "%s/img%d_hc.bmp", outputDir, i);
-        snprintf(salida3, sizeof(salida3), "%s/img%d_vg.bmp", outputDir, i);
-        snprintf(salida4, sizeof(salida4), "%s/img%d_vc.bmp", outputDir, i);
-        snprintf(salida5, sizeof(salida5), "%s/img%d_blur_k%d.bmp", outputDir, i, kernelSize);
-        snprintf(salida6, sizeof(salida6), "%s/img%d_gris.bmp", outputDir, i);
-
-        unsigned long lecturas = 0, escrituras = 0, lecturasBlur = 0;
-        invertirHorizontalGrises(entrada, salida1, log, &lecturas, &escrituras);
-        invertirHorizontalColor(entrada, salida2, log, &lecturas, &escrituras);
-        invertirVerticalGrises(entrada, salida3, log, &lecturas, &escrituras);
-        invertirVerticalColor(entrada, salida4, log, &lecturas, &escrituras);
-        aplicarDesenfoqueIntegral(entrada, salida5, kernelSize, log, &lecturasBlur, &escrituras);
-        convertirAGrises(entrada, salida6, log, &lecturas, &escrituras);
-
-        totalLecturas     += lecturas;
-        totalLecturasBlur += (unsigned long long)lecturasBlur * kernelSize * kernelSize;
-        totalEscrituras   += escrituras;
-
-        fprintf(stderr, "Procesador %d en %s: procesando imagen %d/%d\n", 
-        rank, hostname, i, num_imagenes_total);
-        fflush(stdout);
+    int *ordenCosto = ordenarPorCosto(&pendientes, &kernels);
+    st.orden = ordenCosto;
+    FuenteTrabajo fuente;
+    iniciarFuente(&fuente, &st, size, dinamico, chunk, prefetch);
+    if (enVuelo > 0) ejecutarLotePipeline(&st, &fuente, enVuelo);
+    else ejecutarLote(&st, &fuente);
+    free(ordenCosto);
+    // Rank 0 waits there for the last rank; that is not part of its own wall time
+    double inicioEspera = MPI_Wtime();
+    if (st.progreso) terminarProgreso(st.progreso);
+    double esperaProgreso = MPI_Wtime() - inicioEspera;
+    if (st.cache) {
+        MPI_Barrier(node_comm); // every rank of the node done writing entries
+        if (node_rank == 0) recortarCache(st.cache);
     }
-    printf("\n");
+
+    unsigned long long totalLecturas     = st.lecturas;
+    unsigned long long totalLecturasBlur = st.lecturasBlur;
+    unsigned long long totalEscrituras   = st.escrituras;
 
     // --------- Aggregation & final report ---------
     double endTime = MPI_Wtime();
-    double localTime = endTime - startTime;
+    double localTime = endTime - startTime - esperaProgreso;
     unsigned long long globalLecturas = 0, globalBlur = 0, globalEscrituras = 0;
     MPI_Reduce(&totalLecturasBlur, &globalBlur,      1, MPI_UNSIGNED_LONG_LONG, MPI_SUM, 0, MPI_COMM_WORLD);
     MPI_Reduce(&totalLecturas,     &globalLecturas,1, MPI_UNSIGNED_LONG_LONG, MPI_SUM, 0, MPI_COMM_WORLD);
     MPI_Reduce(&totalEscrituras,   &globalEscrituras,1, MPI_UNSIGNED_LONG_LONG, MPI_SUM, 0, MPI_COMM_WORLD);
     double maxTime;
     MPI_Reduce(&localTime, &maxTime, 1, MPI_DOUBLE, MPI_MAX, 0, MPI_COMM_WORLD);
+    int globalFranjas = 0;
+    MPI_Reduce(&st.imagenesFranjas, &globalFranjas, 1, MPI_INT, MPI_SUM, 0, MPI_COMM_WORLD);
+
+    // Result cache: whole images served, output hits, misses, entries stored,
+    // hits served by hard link, bytes served, bytes hashed
+    unsigned long long cacheLocal[7] = { 0 }, cacheGlobal[7] = { 0 };
+    double hashLocal = 0, hashGlobal = 0;
+    if (st.cache) {
+        cacheLocal[0] = st.imagenesCache;
+        cacheLocal[1] = cache.aciertos;
+        cacheLocal[2] = cache.fallos;
+        cacheLocal[3] = cache.guardadas;
+        cacheLocal[4] = cache.enlazadas;
+        cacheLocal[5] = cache.bytesServidos;
+        cacheLocal[6] = cache.bytesHash;
+        hashLocal = cache.segundosHash;
+    }
+    MPI_Reduce(cacheLocal, cacheGlobal, 7, MPI_UNSIGNED_LONG_LONG, MPI_SUM, 0, MPI_COMM_WORLD);
+    MPI_Reduce(&hashLocal, &hashGlobal, 1, MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD);
+
+    // Buffer pool: requests, hits, growths, pages reused, minor faults taken
+    struct rusage uso;
+    getrusage(RUSAGE_SELF, &uso);
+    unsigned long long poolLocal[5] = { arena.pedidos, arena.aciertos, arena.crecimientos,
+                                        arena.fallosEvitados, (unsigned long long)uso.ru_minflt };
+    unsigned long long poolGlobal[5] = { 0 };
+    MPI_Reduce(poolLocal, poolGlobal, 5, MPI_UNSIGNED_LONG_LONG, MPI_SUM, 0, MPI_COMM_WORLD);
+    unsigned long long picoLocal = arena.pico, picoPool = 0;
+    MPI_Reduce(&picoLocal, &picoPool, 1, MPI_UNSIGNED_LONG_LONG, MPI_MAX, 0, MPI_COMM_WORLD);
+
+    // Latency histograms per filter and rank, as JSON next to final_log.txt
+    terminarLatencias(&latencias);
+    if (escribirReporteLatencias(&latencias, "final_log.json", &pendientes, &kernels, localTime,
+                                 st.tiempoEspera, MPI_COMM_WORLD) != 0) {
+        fprintf(stderr, "No se pudo escribir final_log.json\n");
+    }
+
+    // Per-filter counters; every rank passes the same flags, so all of them reduce
+    MedidaEtapa etapas[NUM_ETAPAS];
+    int eventosDisponibles[NUM_EVENTOS] = { 0 }, errorContadores = 0, conES = 0;
+    unsigned long long esLote[NUM_ES] = { 0 };
+    if (medirContadores) {
+        terminarContadores(&contadores);
+        reducirContadores(&contadores, etapas, eventosDisponibles, &errorContadores, esLote, &conES,
+                          MPI_COMM_WORLD);
+    }
+
+    // Per-rank balance: images, busy seconds, seconds waiting for work, then
+    // the pipeline stages: read, write, compute stalled on read / on write,
+    // then OpenMP threads and whether they are pinned
+#define CAMPOS_BALANCE 9
+    double balanceLocal[CAMPOS_BALANCE] = { st.imagenes, st.tiempoOcupado, st.tiempoEspera,
+                                            st.tiempoLectura, st.tiempoEscritura,
+                                            st.esperaLectura, st.esperaEscritura,
+                                            topologia.hilos, topologia.atados };
+    double *balance = NULL;
+    if (rank == 0) balance = malloc(CAMPOS_BALANCE * size * sizeof(double));
+    MPI_Gather(balanceLocal, CAMPOS_BALANCE, MPI_DOUBLE, balance, CAMPOS_BALANCE, MPI_DOUBLE, 0, MPI_COMM_WORLD);
     MPI_Barrier(MPI_COMM_WORLD);
 
     if (rank == 0) {
         double totalTime = maxTime;
         unsigned long long totalAccesos = globalLecturas + globalEscrituras + globalBlur;
-        double instrucciones = (double)totalAccesos * 20.0 * NUM_THREADS;
+        // Same estimate as before with the threads each rank really ran
+        double hilosMedios = 0;
+        for (int r = 0; r < size; r++) hilosMedios += balance[CAMPOS_BALANCE * r + 7];
+        hilosMedios /= size;
+        double instrucciones = (double)totalAccesos * 20.0 * hilosMedios;
         double mips = (instrucciones / 1e6) / totalTime;
         double mbps = (double)totalAccesos / (1024.0 * 1024.0 * 1024.0) / totalTime;
 
@@ -187,12 +448,73 @@ int main(int argc, char *argv[]) {
         FILE *finalLog = fopen("final_log.txt", "w");
         if (finalLog) {
             fprintf(finalLog, "--- Reporte Final ---\n");
-            fprintf(finalLog, "Kernel utilizado: %d\n", kernelSize);
+            fprintf(finalLog, "Kernel utilizado: ");
+            for (int k = 0; k < kernels.n; k++) fprintf(finalLog, k ? ",%d" : "%d", kernels.tamanos[k]);
+            fprintf(finalLog, "\n");
             fprintf(finalLog, "Total lecturas: %s\n", formattedLecturas);
             fprintf(finalLog, "Total escrituras: %s\n", formattedEscrituras);
             fprintf(finalLog, "Tiempo total: %d min %.2f s\n", minutes, seconds);
             fprintf(finalLog, "Velocidad: %s GB/s\n", formattedMbps);
             fprintf(finalLog, "MIPS estimados: %s\n", formattedMips);
+            int procesadas = 0;
+            for (int r = 0; r < size; r++) procesadas += (int)balance[CAMPOS_BALANCE * r];
+            fprintf(finalLog, "Imagenes procesadas: %d, omitidas (ya completas): %d\n", procesadas, omitidas);
+            if (medirContadores) {
+                escribirReporteContadores(finalLog, etapas, eventosDisponibles, errorContadores, esLote, conES,
+                                          totalTime);
+            }
+            if (memoriaMB > 0) {
+                fprintf(finalLog, "Imagenes por franjas (memoria %ld MB): %d\n", memoriaMB, globalFranjas);
+            }
+            if (cacheDir) {
+                unsigned long long consultas = cacheGlobal[1] + cacheGlobal[2];
+                fprintf(finalLog, "--- Cache de resultados (%s, limite %ld MB) ---\n", cacheDir, cacheMB);
+                fprintf(finalLog, "Imagenes servidas de la cache: %llu\n", cacheGlobal[0]);
+                fprintf(finalLog, "Salidas: %llu aciertos, %llu fallos (%.1f%% aciertos), %llu guardadas\n",
+                        cacheGlobal[1], cacheGlobal[2], consultas > 0 ? 100.0 * cacheGlobal[1] / consultas : 0.0,
+                        cacheGlobal[3]);
+                fprintf(finalLog, "Servido: %.2f GB (%llu enlaces duros, el resto reflink o copia)\n",
+                        cacheGlobal[5] / (1024.0 * 1024.0 * 1024.0), cacheGlobal[4]);
+                fprintf(finalLog, "Hash: %.2f GB en %.2f s (%.2f GB/s)\n", cacheGlobal[6] / (1024.0 * 1024.0 * 1024.0),
+                        hashGlobal, hashGlobal > 0 ? cacheGlobal[6] / (1024.0 * 1024.0 * 1024.0) / hashGlobal : 0.0);
+            }
+            fprintf(finalLog, "--- Pool de buffers%s ---\n", hugepages ? " (hugepages)" : "");
+            fprintf(finalLog, "Pedidos: %llu, aciertos: %llu (%.1f%%), crecimientos: %llu\n",
+                    poolGlobal[0], poolGlobal[1],
+                    poolGlobal[0] > 0 ? 100.0 * poolGlobal[1] / poolGlobal[0] : 0.0, poolGlobal[2]);
+            fprintf(finalLog, "Fallos de pagina evitados: %llu (fallos menores totales: %llu)\n",
+                    poolGlobal[3], poolGlobal[4]);
+            fprintf(finalLog, "Pico del pool por rank: %.2f MB\n", picoPool / (1024.0 * 1024.0));
+
+            double ocupadoMax = 0, ocupadoSuma = 0;
+            for (int r = 0; r < size; r++) {
+                const double *b = &balance[CAMPOS_BALANCE * r];
+                ocupadoSuma += b[1];
+                if (b[1] > ocupadoMax) ocupadoMax = b[1];
+            }
+            double ocupadoMedio = ocupadoSuma / size;
+            fprintf(finalLog, "--- Balance por rank (%s) ---\n", dinamico ? "dinamico" : "estatico");
+            for (int r = 0; r < size; r++) {
+                const double *b = &balance[CAMPOS_BALANCE * r];
+                fprintf(finalLog, "Rank %d: %d imagenes, ocupado %.2f s, espera %.2f s, %d hilos%s\n",
+                        r, (int)b[0], b[1], b[2], (int)b[7], b[8] ? " atados" : "");
+            }
+            fprintf(finalLog, "Desbalance (max/promedio ocupado): %.2f%%\n",
+                    ocupadoMedio > 0 ? (ocupadoMax / ocupadoMedio - 1.0) * 100.0 : 0.0);
+            if (enVuelo > 0) {
+                // Compute stalled on reads means the node is I/O bound on input,
+                // on free slots that it is I/O bound on output
+                fprintf(finalLog, "--- Pipeline por rank (%d ranuras) ---\n", enVuelo);
+                for (int r = 0; r < size; r++) {
+                    const double *b = &balance[CAMPOS_BALANCE * r];
+                    double estancado = b[5] + b[6];
+                    const char *limite = estancado <= 0.1 * b[1] ? "computo"
+                                       : (b[5] >= b[6] ? "E/S lectura" : "E/S escritura");
+                    fprintf(finalLog, "Rank %d: lectura %.2f s, computo %.2f s, escritura %.2f s, "
+                            "espera lectura %.2f s, espera escritura %.2f s (limitado por %s)\n",
+                            r, b[3], b[1], b[4], b[5], b[6], limite);
+                }
+            }
             fclose(finalLog);
             // printf("\nResumen escrito en final_log.txt\n");
         } else {
@@ -200,6 +522,11 @@ int main(int argc, char *argv[]) {
         }
     }
 
+    free(balance);
+    liberarArena(&arena);
+    cerrarDiario(&st);
+    liberarManifiesto(&pendientes);
+    liberarManifiesto(&manifiesto);
     fclose(log);
     MPI_Finalize();
     return 0;
@@ -212,28 +539,6 @@ long long get_free_space_bytes(const char *path) {
     return (long long)stat.f_bsize * stat.f_bavail;
 }
 
-long long calcular_promedio_tamano_imagenes(const char *directorio, int *num_imagenes) {
-    DIR *dir = opendir(directorio);
-    if (!dir) return -1;
-    struct dirent *entry;
-    long long total_size = 0;
-    int count = 0;
-    while ((entry = readdir(dir)) != NULL) {
-        if (strstr(entry->d_name, ".bmp")) {
-            char path[512];
-            snprintf(path, sizeof(path), "%s/%s", directorio, entry->d_name);
-            struct stat st;
-            if (stat(path, &st) == 0) {
-                total_size += st.st_size;
-                count++;
-            }
-        }
-    }
-    closedir(dir);
-    if (num_imagenes) *num_imagenes = count;
-    return count > 0 ? total_size / count : -1;
-}
-
 void formatNumberWithCommas(const char *numStr, char *buffer) {
     char intPart[64], decPart[64] = "";
     char temp[64];
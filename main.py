@@ -39,10 +39,7 @@ class MainWindow(QtWidgets.QMainWindow):
         self.proc.finished.connect(self.handle_finished)
 
         self.total_images = 0
-
-        # Timer for checking ./processed
-        self.timer = QtCore.QTimer(self)
-        self.timer.timeout.connect(self.check_progress_folder)
+        self.pending_output = ""
 
     def seleccionar_entrada(self):
         carpeta = QtWidgets.QFileDialog.getExistingDirectory(self, "Selecciona carpeta de entrada")
@@ -77,16 +74,9 @@ class MainWindow(QtWidgets.QMainWindow):
                                           "Debes seleccionar ambas carpetas.")
             return
 
-        # Clear previous output images
-        if os.path.isdir(salida):
-            for f in os.listdir(salida):
-                if f.lower().endswith('.bmp'):
-                    try:
-                        os.remove(os.path.join(salida, f))
-                    except Exception:
-                        pass
-        else:
-            os.makedirs(salida, exist_ok=True)
+        # Keep previous outputs: with --reanudar main.exe skips the images
+        # that are already complete and only processes the rest
+        os.makedirs(salida, exist_ok=True)
 
         # Count .bmp files in input
         bmp_files = [f for f in os.listdir(entrada) if f.lower().endswith('.bmp')]
@@ -101,35 +91,49 @@ class MainWindow(QtWidgets.QMainWindow):
         self.ui.progressBar.setMaximum(self.total_images)
         self.ui.progressBar.setValue(0)
         self.ui.estimatedTime.setText(f"Imágenes procesadas: 0/{self.total_images}")
-
-        # Start timer for dynamic progress update
-        self.timer.start(500)  # every 0.5 seconds for smoother updates
+        self.pending_output = ""
 
         hostfile = "/mirror/machinefile"
         args = [
             "--mca", "btl_tcp_if_include", "enp0s8",
             "--mca", "oob_tcp_if_include", "enp0s8",
             "--mca", "plm_rsh_no_tree_spawn", "1",
+            "--bind-to", "none",
             "--hostfile", hostfile,
             "./main.exe",
-            str(kernel), entrada, salida, str(total)
+            str(kernel), entrada, salida, str(total),
+            "--reanudar", "--previas"
         ]
 
         self.proc.start("mpirun", args)
 
     def handle_stdout(self):
-        out = self.proc.readAllStandardOutput().data().decode('utf-8', 'ignore')
-        for line in out.splitlines():
-            if line.startswith("Procesador"):
-                print(line)
-        self.check_progress_folder()
-        _ = self.proc.readAllStandardOutput()
+        # main.exe prints "PROGRESO imagenes=X/Y bytes=... eta_s=..." lines;
+        # output may arrive in pieces, so keep the unfinished last line
+        self.pending_output += self.proc.readAllStandardOutput().data().decode('utf-8', 'ignore')
+        lines = self.pending_output.split("\n")
+        self.pending_output = lines.pop()
+        for line in lines:
+            if line.startswith("PROGRESO "):
+                self.update_progress(line)
+
+    def update_progress(self, line):
+        fields = dict(f.split("=", 1) for f in line.split()[1:] if "=" in f)
+        try:
+            done, pending = (int(v) for v in fields["imagenes"].split("/"))
+            eta = float(fields["eta_s"])
+        except (KeyError, ValueError):
+            return
+        # With --reanudar only the images still missing are counted
+        images_done = min(self.total_images - pending + done, self.total_images)
 
-    def handle_finished(self):
-        # Ensure the last folder check
-        self.check_progress_folder()
-        self.timer.stop()
+        self.ui.progressBar.setValue(images_done)
+        text = f"Imágenes procesadas: {images_done}/{self.total_images}"
+        if eta >= 0 and "fin" not in fields:
+            text += f" - restante: {int(eta) // 60} min {int(eta) % 60} s"
+        self.ui.estimatedTime.setText(text)
 
+    def handle_finished(self):
         self.ui.progressBar.setValue(self.total_images)
         self.ui.estimatedTime.setText(
             f"Imágenes procesadas: {self.total_images}/{self.total_images}"
@@ -145,21 +149,6 @@ class MainWindow(QtWidgets.QMainWindow):
         self.limpiar_imagenes()
         self.mostrar_imagenes_procesadas(self.ui.carpetaSalida.text())
 
-    def check_progress_folder(self):
-        output_dir = self.ui.carpetaSalida.text()
-        if not os.path.isdir(output_dir):
-            return
-
-        processed_files = len([f for f in os.listdir(output_dir) if f.lower().endswith(".bmp")])
-        # Each input image produces 6 outputs
-        images_done = processed_files // 6
-        # Clamp
-        if images_done > self.total_images:
-            images_done = self.total_images
-
-        self.ui.progressBar.setValue(images_done)
-        self.ui.estimatedTime.setText(f"Imágenes procesadas: {images_done}/{self.total_images}")
-
     def generar_txt(self):
         log_path = os.path.join(os.getcwd(), "final_log.txt")
         try:
@@ -186,6 +175,12 @@ class MainWindow(QtWidgets.QMainWindow):
             m = re.match(r".*?(\d+)", name)
             return int(m.group(1)) if m else float('inf')
 
+        # main.exe --previas leaves 120 px thumbnails of every output in
+        # <salida>/previas; fall back to scaling the full images without them
+        ruta_previas = os.path.join(ruta_salida, "previas")
+        if os.path.isdir(ruta_previas):
+            ruta_salida = ruta_previas
+
         bmp_files = sorted(
             [f for f in os.listdir(ruta_salida) if f.lower().endswith(".bmp")],
             key=extract_num
@@ -194,9 +189,11 @@ class MainWindow(QtWidgets.QMainWindow):
         for nombre in bmp_files:
             ruta = os.path.join(ruta_salida, nombre)
             label_img = QtWidgets.QLabel()
-            pixmap = QtGui.QPixmap(ruta).scaled(120, 120,
-                                                QtCore.Qt.KeepAspectRatio,
-                                                QtCore.Qt.SmoothTransformation)
+            pixmap = QtGui.QPixmap(ruta)
+            if pixmap.width() > 120 or pixmap.height() > 120:
+                pixmap = pixmap.scaled(120, 120,
+                                       QtCore.Qt.KeepAspectRatio,
+                                       QtCore.Qt.SmoothTransformation)
             label_img.setPixmap(pixmap)
             label_img.setAlignment(QtCore.Qt.AlignCenter)
 
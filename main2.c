@@ -1,4 +1,5 @@
 #include "image_processing.h"
+#include "topologia.h"
 #include <mpi.h>
 #include <omp.h>
 #include <stdio.h>
@@ -6,16 +7,48 @@
 #include <string.h>
 #include <locale.h>
 #include <time.h>
+#include <dirent.h>
 #include <sys/stat.h>
 #include <unistd.h>
 
-#define NUM_THREADS 6
+// Spool del servicio: cada <nombre>.trabajo tiene cuatro lineas (kernels,
+// inputDir, outputDir, imageFile), los mismos argumentos de una corrida por
+// imagen. El servicio lo pasa a .enproceso y al terminar deja .hecho
+// ("segundos lecturas escrituras") o .error con el motivo.
+#define EXT_TRABAJO ".trabajo"
+#define EXT_HECHO   ".hecho"
+#define EXT_ERROR   ".error"
+#define MAX_MOTIVO  256 // texto de error de cada rank que llega al .error
+
+enum { TRABAJO_IMAGEN, TRABAJO_DETENER };
+
+typedef struct {
+    int estado;
+    char kernels[64];
+    char inputDir[512];
+    char outputDir[512];
+    char imagen[256];
+} Trabajo;
+
+// Contadores de acumulador.txt y tiempo.txt
+typedef struct {
+    unsigned long long lecturas, escrituras;
+    double instrucciones, segundos;
+} Acumulado;
+
+static int procesarTrabajo(const Trabajo *t, const ListaKernels *kernels, int rank, int size, int hilosTotales,
+                           Acumulado *res, char *motivo, size_t tamMotivo);
+static int tomarTrabajo(const char *spool, Trabajo *t, char *enProceso, size_t tam);
+static void terminarTrabajo(const char *enProceso, const char *ext, const char *contenido);
+static int servir(const char *spool, int rank, int size, int hilosTotales);
 
 void formatNumberWithCommas(const char *numStr, char *buffer);
-void guardar_acumulados(unsigned long long lecturas, unsigned long long escrituras, double instrucciones);
 void leer_acumulados(unsigned long long *lecturas, unsigned long long *escrituras, double *instrucciones);
-void guardar_tiempo(double segundos);
 double leer_tiempo();
+static int escribirAtomico(const char *ruta, const char *contenido);
+static void leerAcumulado(Acumulado *a);
+static void sumarAcumulado(Acumulado *a, const Acumulado *b);
+static void guardarAcumulado(const Acumulado *a);
 
 int main(int argc, char *argv[]) {
     MPI_Init(&argc, &argv);
@@ -25,20 +58,18 @@ int main(int argc, char *argv[]) {
     MPI_Comm_size(MPI_COMM_WORLD, &size);
 
     setlocale(LC_NUMERIC, "C");
-    omp_set_num_threads(NUM_THREADS);
+
+    // Hilos por rank segun los CPUs del host y cuantos ranks lo comparten
+    char hostname[MAX_HOSTNAME];
+    MPI_Comm nodo = dividirPorNodo(MPI_COMM_WORLD, hostname);
+    Topologia topologia;
+    configurarTopologia(nodo, 0, 1, &topologia);
+    MPI_Comm_free(&nodo);
 
     if (argc == 2 && strcmp(argv[1], "--start") == 0) {
         if (rank == 0) {
-            FILE *f = fopen("acumulador.txt", "w");
-            if (f) {
-                fprintf(f, "0 0 0.0\n");
-                fclose(f);
-            }
-            FILE *t = fopen("tiempo.txt", "w");
-            if (t) {
-                fprintf(t, "0.0\n");
-                fclose(t);
-            }
+            Acumulado cero = { 0 };
+            guardarAcumulado(&cero);
         }
         MPI_Finalize();
         return 0;
@@ -85,47 +116,124 @@ int main(int argc, char *argv[]) {
         return 0;
     }
 
+    int hilosTotales = 0;
+    MPI_Allreduce(&topologia.hilos, &hilosTotales, 1, MPI_INT, MPI_SUM, MPI_COMM_WORLD);
+
+    if (argc == 3 && strcmp(argv[1], "--servicio") == 0) {
+        int rc = servir(argv[2], rank, size, hilosTotales);
+        MPI_Finalize();
+        return rc;
+    }
+
     if (argc < 5) {
-        if (rank == 0)
+        if (rank == 0) {
             fprintf(stderr, "Uso: %s <kernel> <inputDir> <outputDir> <imageFile>\n", argv[0]);
+            fprintf(stderr, "     %s --servicio <dirSpool>\n", argv[0]);
+        }
         MPI_Finalize();
         return 1;
     }
 
-    int kernel = atoi(argv[1]);
-    const char *inputDir = argv[2];
-    const char *outputDir = argv[3];
-    const char *imageName = argv[4];
+    Trabajo t;
+    memset(&t, 0, sizeof(t));
+    t.estado = TRABAJO_IMAGEN;
+    snprintf(t.kernels, sizeof(t.kernels), "%s", argv[1]);
+    snprintf(t.inputDir, sizeof(t.inputDir), "%s", argv[2]);
+    snprintf(t.outputDir, sizeof(t.outputDir), "%s", argv[3]);
+    snprintf(t.imagen, sizeof(t.imagen), "%s", argv[4]);
+
+    ListaKernels kernels;
+    if (parsearKernels(t.kernels, &kernels) != 0) {
+        if (rank == 0) fprintf(stderr, "Kernels invalidos: %s (impares entre %d y %d)\n", argv[1], KERNEL_MINIMO,
+                               KERNEL_MAXIMO);
+        MPI_Finalize();
+        return 1;
+    }
+
+    Acumulado imagen;
+    char motivo[MAX_MOTIVO * 8];
+    if (procesarTrabajo(&t, &kernels, rank, size, hilosTotales, &imagen, motivo, sizeof(motivo)) != 0) {
+        if (rank == 0) fprintf(stderr, "%s", motivo);
+        MPI_Finalize();
+        return 1;
+    }
+    if (rank == 0) {
+        // Corrida suelta: suma a lo que dejaron las anteriores
+        Acumulado total;
+        leerAcumulado(&total);
+        sumarAcumulado(&total, &imagen);
+        guardarAcumulado(&total);
+    }
+
+    MPI_Finalize();
+    return 0;
+}
+
+// Aplica a una imagen el efecto que le toca a este rank y reduce los
+// contadores y los fallos en el rank 0, que recibe el resultado en res. En el
+// rank 0 devuelve 1 si algun efecto fallo, con una linea por rank fallido en
+// motivo; en los demas ranks, 0.
+static int procesarTrabajo(const Trabajo *t, const ListaKernels *kernels, int rank, int size, int hilosTotales,
+                           Acumulado *res, char *motivo, size_t tamMotivo) {
+    int kernel = kernels->tamanos[0];
 
-    char entrada[512];
-    snprintf(entrada, sizeof(entrada), "%s/%s", inputDir, imageName);
+    char entrada[1024];
+    snprintf(entrada, sizeof(entrada), "%s/%s", t->inputDir, t->imagen);
 
-    char base[128];
-    strncpy(base, imageName, sizeof(base));
+    char base[256];
+    snprintf(base, sizeof(base), "%s", t->imagen);
     char *ext = strrchr(base, '.');
     if (ext) *ext = '\0';
 
-    char salida1[512], salida2[512], salida3[512], salida4[512], salida5[512], salida6[512];
+    const char *outputDir = t->outputDir;
+    char salida1[1024], salida2[1024], salida3[1024], salida4[1024], salida6[1024], salida7[1024];
     snprintf(salida1, sizeof(salida1), "%s/%s_hg.bmp", outputDir, base);
     snprintf(salida2, sizeof(salida2), "%s/%s_hc.bmp", outputDir, base);
     snprintf(salida3, sizeof(salida3), "%s/%s_vg.bmp", outputDir, base);
     snprintf(salida4, sizeof(salida4), "%s/%s_vc.bmp", outputDir, base);
-    snprintf(salida5, sizeof(salida5), "%s/%s_blur_k%d.bmp", outputDir, base, kernel);
     snprintf(salida6, sizeof(salida6), "%s/%s_gris.bmp", outputDir, base);
+    snprintf(salida7, sizeof(salida7), "%s/%s_gauss_s%.1f.bmp", outputDir, base, sigmaGauss(kernel));
+    char salidasBlur[MAX_KERNELS][1024];
+    const char *salida5[MAX_KERNELS];
+    unsigned long long ventanas = 0; // suma de k*k: lecturas por pixel de todos los desenfoques
+    for (int k = 0; k < kernels->n; k++) {
+        snprintf(salidasBlur[k], sizeof(salidasBlur[k]), "%s/%s_blur_k%d.bmp", outputDir, base, kernels->tamanos[k]);
+        salida5[k] = salidasBlur[k];
+        ventanas += (unsigned long long)kernels->tamanos[k] * kernels->tamanos[k];
+    }
 
     unsigned long lecturasLocal = 0, lecturasBlurLocal = 0, escriturasLocal = 0;
+    // Los efectos dejan el motivo de un fallo en este log en memoria
+    char *textoLog = NULL;
+    size_t tamLog = 0;
+    FILE *log = open_memstream(&textoLog, &tamLog);
     double startTime = MPI_Wtime();
 
     // Distribuir los efectos entre procesos
-    if (rank == 0) invertirHorizontalGrises(entrada, salida1, NULL, &lecturasLocal, &escriturasLocal);
-    else if (rank == 1) invertirHorizontalColor(entrada, salida2, NULL, &lecturasLocal, &escriturasLocal);
-    else if (rank == 2) invertirVerticalGrises(entrada, salida3, NULL, &lecturasLocal, &escriturasLocal);
-    else if (rank == 3) invertirVerticalColor(entrada, salida4, NULL, &lecturasLocal, &escriturasLocal);
-    else if (rank == 4) aplicarDesenfoqueIntegral(entrada, salida5, kernel, NULL, &lecturasBlurLocal, &escriturasLocal);
-    else if (rank == 5) convertirAGrises(entrada, salida6, NULL, &lecturasLocal, &escriturasLocal);
+    int estado = 0;
+    if (rank == 0) estado = invertirHorizontalGrises(entrada, salida1, log, &lecturasLocal, &escriturasLocal);
+    else if (rank == 1) estado = invertirHorizontalColor(entrada, salida2, log, &lecturasLocal, &escriturasLocal);
+    else if (rank == 2) estado = invertirVerticalGrises(entrada, salida3, log, &lecturasLocal, &escriturasLocal);
+    else if (rank == 3) estado = invertirVerticalColor(entrada, salida4, log, &lecturasLocal, &escriturasLocal);
+    else if (rank == 4) estado = aplicarDesenfoqueIntegralKernels(entrada, salida5, kernels, log, &lecturasBlurLocal, &escriturasLocal);
+    else if (rank == 5) estado = convertirAGrises(entrada, salida6, log, &lecturasLocal, &escriturasLocal);
+    else if (rank == 6) estado = aplicarDesenfoqueGaussiano(entrada, salida7, sigmaGauss(kernel), log, &lecturasBlurLocal, &escriturasLocal);
 
     double elapsed = MPI_Wtime() - startTime;
 
+    int falloLocal = estado != 0, fallo = 0;
+    char motivoLocal[MAX_MOTIVO] = "";
+    if (log) {
+        fclose(log);
+        if (textoLog) snprintf(motivoLocal, sizeof(motivoLocal), "%s", textoLog);
+        free(textoLog);
+    }
+    motivoLocal[strcspn(motivoLocal, "\n")] = '\0';
+    if (falloLocal && !motivoLocal[0]) snprintf(motivoLocal, sizeof(motivoLocal), "el efecto fallo");
+    MPI_Reduce(&falloLocal, &fallo, 1, MPI_INT, MPI_LOR, 0, MPI_COMM_WORLD);
+    char *motivos = rank == 0 ? malloc((size_t)size * MAX_MOTIVO) : NULL;
+    MPI_Gather(falloLocal ? motivoLocal : "", MAX_MOTIVO, MPI_CHAR, motivos, MAX_MOTIVO, MPI_CHAR, 0, MPI_COMM_WORLD);
+
     unsigned long long globalLecturas = 0, globalLecturasBlur = 0, globalEscrituras = 0;
     MPI_Reduce(&lecturasLocal, &globalLecturas, 1, MPI_UNSIGNED_LONG_LONG, MPI_SUM, 0, MPI_COMM_WORLD);
     MPI_Reduce(&lecturasBlurLocal, &globalLecturasBlur, 1, MPI_UNSIGNED_LONG_LONG, MPI_SUM, 0, MPI_COMM_WORLD);
@@ -135,14 +243,153 @@ int main(int argc, char *argv[]) {
     MPI_Reduce(&elapsed, &maxTime, 1, MPI_DOUBLE, MPI_MAX, 0, MPI_COMM_WORLD);
 
     if (rank == 0) {
-        unsigned long long totalLecturas = globalLecturas + globalLecturasBlur * kernel * kernel;
-        double instrucciones = (double)(totalLecturas + globalEscrituras) * 20.0 * NUM_THREADS;
+        res->lecturas = globalLecturas + globalLecturasBlur * ventanas;
+        res->escrituras = globalEscrituras;
+        res->instrucciones = (double)(res->lecturas + res->escrituras) * 20.0 * hilosTotales / size;
+        res->segundos = maxTime;
+        size_t usado = 0;
+        motivo[0] = '\0';
+        for (int r = 0; motivos && r < size && usado < tamMotivo; r++) {
+            const char *m = motivos + (size_t)r * MAX_MOTIVO;
+            if (m[0]) usado += snprintf(motivo + usado, tamMotivo - usado, "rank %d: %.*s\n", r, MAX_MOTIVO, m);
+        }
+        free(motivos);
+    }
+    return fallo;
+}
 
-        guardar_acumulados(totalLecturas, globalEscrituras, instrucciones);
-        guardar_tiempo(maxTime);
+// --------- Servicio ---------
+
+// Toma el primer trabajo del spool en orden de nombre: lo renombra a
+// .enproceso (si otro servicio lo renombro antes, sigue con el proximo) y
+// lee sus cuatro lineas. Espera mientras no haya trabajos; sin trabajos y con
+// el archivo "detener" en el spool, lo borra y devuelve TRABAJO_DETENER.
+static int tomarTrabajo(const char *spool, Trabajo *t, char *enProceso, size_t tam) {
+    for (;;) {
+        DIR *dir = opendir(spool);
+        if (!dir) {
+            fprintf(stderr, "No se pudo abrir el spool %s\n", spool);
+            return TRABAJO_DETENER;
+        }
+        char primero[256] = "";
+        struct dirent *d;
+        while ((d = readdir(dir)) != NULL) {
+            size_t n = strlen(d->d_name), ne = strlen(EXT_TRABAJO);
+            if (n <= ne || n >= sizeof(primero) || strcmp(d->d_name + n - ne, EXT_TRABAJO) != 0) continue;
+            if (!primero[0] || strcmp(d->d_name, primero) < 0) strcpy(primero, d->d_name);
+        }
+        closedir(dir);
+
+        if (primero[0]) {
+            char ruta[1024];
+            snprintf(ruta, sizeof(ruta), "%s/%s", spool, primero);
+            primero[strlen(primero) - strlen(EXT_TRABAJO)] = '\0';
+            snprintf(enProceso, tam, "%s/%s.enproceso", spool, primero);
+            if (rename(ruta, enProceso) != 0) continue;
+
+            memset(t, 0, sizeof(*t));
+            t->estado = TRABAJO_IMAGEN;
+            char *campos[4] = { t->kernels, t->inputDir, t->outputDir, t->imagen };
+            size_t tamanos[4] = { sizeof(t->kernels), sizeof(t->inputDir), sizeof(t->outputDir), sizeof(t->imagen) };
+            FILE *f = fopen(enProceso, "r");
+            int leidos = 0;
+            while (f && leidos < 4 && fgets(campos[leidos], tamanos[leidos], f)) {
+                campos[leidos][strcspn(campos[leidos], "\r\n")] = '\0';
+                leidos++;
+            }
+            if (f) fclose(f);
+            if (leidos == 4) return TRABAJO_IMAGEN;
+            terminarTrabajo(enProceso, EXT_ERROR, "formato invalido\n");
+            continue;
+        }
+
+        char detener[1024];
+        snprintf(detener, sizeof(detener), "%s/detener", spool);
+        if (unlink(detener) == 0) return TRABAJO_DETENER;
+        struct timespec pausa = { 0, 10 * 1000000L };
+        nanosleep(&pausa, NULL);
     }
+}
 
-    MPI_Finalize();
+// Reemplaza .enproceso por el archivo de resultado con la extension dada
+static void terminarTrabajo(const char *enProceso, const char *ext, const char *contenido) {
+    char ruta[1024];
+    snprintf(ruta, sizeof(ruta), "%.*s%s", (int)(strlen(enProceso) - strlen(".enproceso")), enProceso, ext);
+    escribirAtomico(ruta, contenido);
+    unlink(enProceso);
+}
+
+// Difunde el trabajo del rank 0. Los demas ranks esperan con pausas cortas en
+// lugar del sondeo activo de un MPI_Bcast bloqueante, asi un servicio ocioso
+// no ocupa sus CPUs.
+static void difundirTrabajo(Trabajo *t, int rank) {
+    MPI_Request req;
+    MPI_Ibcast(t, sizeof(*t), MPI_BYTE, 0, MPI_COMM_WORLD, &req);
+    if (rank == 0) {
+        MPI_Wait(&req, MPI_STATUS_IGNORE);
+        return;
+    }
+    int listo = 0;
+    struct timespec pausa = { 0, 1000000L };
+    for (;;) {
+        MPI_Test(&req, &listo, MPI_STATUS_IGNORE);
+        if (listo) return;
+        nanosleep(&pausa, NULL);
+    }
+}
+
+// Lanza el trabajo MPI una sola vez y atiende las imagenes que aparecen en
+// el spool. Los contadores quedan en memoria y se vuelcan completos despues
+// de cada imagen con escrituras atomicas, asi --end lee un total consistente
+// aun con el servicio corriendo.
+static int servir(const char *spool, int rank, int size, int hilosTotales) {
+    Acumulado total;
+    if (rank == 0) {
+        leerAcumulado(&total);
+        printf("Servicio listo: %d procesos, spool %s\n", size, spool);
+    }
+
+    for (;;) {
+        Trabajo t;
+        memset(&t, 0, sizeof(t));
+        char enProceso[1024] = "";
+        ListaKernels kernels;
+        if (rank == 0) {
+            // Los trabajos invalidos se contestan sin molestar a los demas ranks
+            for (;;) {
+                t.estado = tomarTrabajo(spool, &t, enProceso, sizeof(enProceso));
+                if (t.estado == TRABAJO_DETENER) break;
+                char entrada[1024];
+                snprintf(entrada, sizeof(entrada), "%s/%s", t.inputDir, t.imagen);
+                if (parsearKernels(t.kernels, &kernels) != 0) {
+                    terminarTrabajo(enProceso, EXT_ERROR, "kernels invalidos\n");
+                } else if (access(entrada, R_OK) != 0) {
+                    terminarTrabajo(enProceso, EXT_ERROR, "no se puede leer la imagen\n");
+                } else {
+                    break;
+                }
+            }
+        }
+        difundirTrabajo(&t, rank);
+        if (t.estado == TRABAJO_DETENER) break;
+        parsearKernels(t.kernels, &kernels);
+
+        Acumulado imagen;
+        char motivo[MAX_MOTIVO * 8];
+        if (procesarTrabajo(&t, &kernels, rank, size, hilosTotales, &imagen, motivo, sizeof(motivo)) != 0) {
+            // Solo el rank 0 recibe el fallo; en los demas procesarTrabajo da 0
+            terminarTrabajo(enProceso, EXT_ERROR, motivo);
+            printf("Imagen %s: error\n", t.imagen);
+        } else if (rank == 0) {
+            sumarAcumulado(&total, &imagen);
+            guardarAcumulado(&total);
+            char resultado[128];
+            snprintf(resultado, sizeof(resultado), "%.6f %llu %llu\n", imagen.segundos, imagen.lecturas,
+                     imagen.escrituras);
+            terminarTrabajo(enProceso, EXT_HECHO, resultado);
+            printf("Imagen %s: %.3f s\n", t.imagen, imagen.segundos);
+        }
+    }
     return 0;
 }
 
@@ -168,16 +415,6 @@ void formatNumberWithCommas(const char *numStr, char *buffer) {
     else strcpy(buffer, temp);
 }
 
-void guardar_acumulados(unsigned long long l, unsigned long long e, double ins) {
-    unsigned long long lOld = 0, eOld = 0; double insOld = 0;
-    leer_acumulados(&lOld, &eOld, &insOld);
-    FILE *f = fopen("acumulador.txt", "w");
-    if (f) {
-        fprintf(f, "%llu %llu %.2f\n", lOld + l, eOld + e, insOld + ins);
-        fclose(f);
-    }
-}
-
 void leer_acumulados(unsigned long long *l, unsigned long long *e, double *ins) {
     FILE *f = fopen("acumulador.txt", "r");
     if (f) {
@@ -186,15 +423,6 @@ void leer_acumulados(unsigned long long *l, unsigned long long *e, double *ins)
     }
 }
 
-void guardar_tiempo(double segundos) {
-    double viejo = leer_tiempo();
-    FILE *f = fopen("tiempo.txt", "w");
-    if (f) {
-        fprintf(f, "%.2f\n", viejo + segundos);
-        fclose(f);
-    }
-}
-
 double leer_tiempo() {
     double t = 0.0;
     FILE *f = fopen("tiempo.txt", "r");
@@ -204,3 +432,40 @@ double leer_tiempo() {
     }
     return t;
 }
+
+// Escribe en un temporal y lo renombra: quien lea la ruta ve el contenido
+// anterior o el nuevo, nunca uno a medias
+static int escribirAtomico(const char *ruta, const char *contenido) {
+    char tmp[1100];
+    snprintf(tmp, sizeof(tmp), "%s.tmp.%d", ruta, (int)getpid());
+    FILE *f = fopen(tmp, "w");
+    if (!f) return -1;
+    int error = fputs(contenido, f) < 0;
+    error |= fclose(f) != 0;
+    if (error || rename(tmp, ruta) != 0) {
+        unlink(tmp);
+        return -1;
+    }
+    return 0;
+}
+
+static void leerAcumulado(Acumulado *a) {
+    memset(a, 0, sizeof(*a));
+    leer_acumulados(&a->lecturas, &a->escrituras, &a->instrucciones);
+    a->segundos = leer_tiempo();
+}
+
+static void sumarAcumulado(Acumulado *a, const Acumulado *b) {
+    a->lecturas += b->lecturas;
+    a->escrituras += b->escrituras;
+    a->instrucciones += b->instrucciones;
+    a->segundos += b->segundos;
+}
+
+static void guardarAcumulado(const Acumulado *a) {
+    char texto[128];
+    snprintf(texto, sizeof(texto), "%llu %llu %.2f\n", a->lecturas, a->escrituras, a->instrucciones);
+    escribirAtomico("acumulador.txt", texto);
+    snprintf(texto, sizeof(texto), "%.2f\n", a->segundos);
+    escribirAtomico("tiempo.txt", texto);
+}
@@ -0,0 +1,269 @@
+// manifiesto.c
+#include "manifiesto.h"
+#include "image_processing.h"
+#include "qoi.h"
+#include <ctype.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <strings.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Costo fijo por imagen (apertura, mapeo y siete archivos de salida) en
+// equivalentes de pixel, y costo por pixel de los cinco filtros por pixel
+// mas el desenfoque y las pasadas del gaussiano
+#define COSTO_FIJO_IMAGEN   65536.0
+#define COSTO_PIXEL_FILTROS 5.0
+#define COSTO_PIXEL_BLUR    1.0
+
+// Orden natural: "img2.bmp" antes que "img10.bmp"
+static int compararNatural(const void *a, const void *b) {
+    const char *x = a, *y = b;
+    while (*x && *y) {
+        if (isdigit((unsigned char)*x) && isdigit((unsigned char)*y)) {
+            while (*x == '0') x++;
+            while (*y == '0') y++;
+            size_t lx = 0, ly = 0;
+            while (isdigit((unsigned char)x[lx])) lx++;
+            while (isdigit((unsigned char)y[ly])) ly++;
+            if (lx != ly) return lx < ly ? -1 : 1;
+            int c = strncmp(x, y, lx);
+            if (c) return c;
+            x += lx;
+            y += ly;
+        } else {
+            if (*x != *y) return (unsigned char)*x < (unsigned char)*y ? -1 : 1;
+            x++;
+            y++;
+        }
+    }
+    return (unsigned char)*x - (unsigned char)*y;
+}
+
+static int esBMP(const char *nombre) {
+    size_t len = strlen(nombre);
+    return len > 4 && strcasecmp(nombre + len - 4, ".bmp") == 0;
+}
+
+// Lee tamano y cabeceras de una imagen; deja ancho/alto en 0 si no es valida
+static void leerEntrada(const char *directorio, EntradaManifiesto *e) {
+    char path[512];
+    snprintf(path, sizeof(path), "%s/%s", directorio, e->nombre);
+    e->bytes = 0;
+    e->ancho = e->alto = 0;
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return;
+    struct stat st;
+    uint8_t cabeceras[sizeof(BMPHeader) + sizeof(DIBHeader)];
+    if (fstat(fd, &st) == 0 && pread(fd, cabeceras, sizeof(cabeceras), 0) == (ssize_t)sizeof(cabeceras)) {
+        // Las mismas comprobaciones que leerImagenBMP, asi un archivo truncado
+        // cuenta como descartado y no entra en el reparto ni en el espacio
+        ImagenBMP img;
+        memset(&img, 0, sizeof(img));
+        memcpy(&img.header, cabeceras, sizeof(BMPHeader));
+        memcpy(&img.dib, cabeceras + sizeof(BMPHeader), sizeof(DIBHeader));
+        e->bytes = st.st_size;
+        if (validarCabeceras(&img, st.st_size) == NULL) {
+            e->ancho = img.dib.width;
+            e->alto = img.dib.height;
+        }
+    }
+    close(fd);
+}
+
+int construirManifiesto(const char *directorio, int limite, MPI_Comm comm, Manifiesto *m) {
+    int rank, size;
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &size);
+    memset(m, 0, sizeof(*m));
+
+    // Rank 0 lista el directorio y difunde los nombres
+    char (*nombres)[MAX_NOMBRE_IMAGEN] = NULL;
+    int n = 0;
+    if (rank == 0) {
+        DIR *dir = opendir(directorio);
+        if (dir) {
+            int capacidad = 0;
+            struct dirent *entry;
+            while ((entry = readdir(dir)) != NULL) {
+                if (!esBMP(entry->d_name) || strlen(entry->d_name) >= MAX_NOMBRE_IMAGEN) continue;
+                if (n == capacidad) {
+                    int nueva = capacidad ? capacidad * 2 : 256;
+                    char (*mas)[MAX_NOMBRE_IMAGEN] = realloc(nombres, nueva * sizeof(*nombres));
+                    if (!mas) {
+                        n = MANIFIESTO_SIN_MEMORIA; // el listado falla entero
+                        break;
+                    }
+                    nombres = mas;
+                    capacidad = nueva;
+                }
+                strcpy(nombres[n++], entry->d_name);
+            }
+            closedir(dir);
+            if (n > 0) qsort(nombres, n, sizeof(*nombres), compararNatural);
+            if (limite > 0 && n > limite) n = limite;
+        } else {
+            n = -1;
+        }
+    }
+    MPI_Bcast(&n, 1, MPI_INT, 0, comm);
+    if (n <= 0) {
+        free(nombres);
+        return n == MANIFIESTO_SIN_MEMORIA ? MANIFIESTO_SIN_MEMORIA : -1;
+    }
+
+    // Todos los ranks siguen o ninguno: las llamadas de abajo son colectivas
+    m->entradas = calloc(n, sizeof(EntradaManifiesto));
+    int *cuentas = malloc(size * sizeof(int));
+    int *desplazamientos = malloc(size * sizeof(int));
+    int sinMemoria = !m->entradas || !cuentas || !desplazamientos;
+    MPI_Allreduce(MPI_IN_PLACE, &sinMemoria, 1, MPI_INT, MPI_LOR, comm);
+    if (sinMemoria) {
+        free(nombres);
+        free(cuentas);
+        free(desplazamientos);
+        liberarManifiesto(m);
+        return MANIFIESTO_SIN_MEMORIA;
+    }
+    if (rank == 0) {
+        for (int i = 0; i < n; i++) memcpy(m->entradas[i].nombre, nombres[i], MAX_NOMBRE_IMAGEN);
+        free(nombres);
+    }
+    // Solo viajan los nombres; el resto de la entrada lo llena cada rank
+    MPI_Datatype tipoNombres;
+    MPI_Type_contiguous(MAX_NOMBRE_IMAGEN, MPI_CHAR, &tipoNombres);
+    MPI_Datatype tipoEntradaNombre;
+    MPI_Type_create_resized(tipoNombres, 0, sizeof(EntradaManifiesto), &tipoEntradaNombre);
+    MPI_Type_commit(&tipoEntradaNombre);
+    MPI_Bcast(m->entradas, n, tipoEntradaNombre, 0, comm);
+    MPI_Type_free(&tipoEntradaNombre);
+    MPI_Type_free(&tipoNombres);
+
+    // Cada rank lee las cabeceras de su tramo contiguo
+    for (int r = 0; r < size; r++) {
+        int ini = (int)((long long)n * r / size), fin = (int)((long long)n * (r + 1) / size);
+        cuentas[r] = (fin - ini) * (int)sizeof(EntradaManifiesto);
+        desplazamientos[r] = ini * (int)sizeof(EntradaManifiesto);
+    }
+    int ini = (int)((long long)n * rank / size), fin = (int)((long long)n * (rank + 1) / size);
+    for (int i = ini; i < fin; i++) leerEntrada(directorio, &m->entradas[i]);
+
+    MPI_Allgatherv(MPI_IN_PLACE, 0, MPI_BYTE, m->entradas, cuentas, desplazamientos, MPI_BYTE, comm);
+    free(cuentas);
+    free(desplazamientos);
+
+    // Se descartan las que no son BMP de 24 bits, igual en todos los ranks
+    int validas = 0;
+    for (int i = 0; i < n; i++) {
+        if (m->entradas[i].ancho > 0) m->entradas[validas++] = m->entradas[i];
+    }
+    m->n = validas;
+    m->descartadas = n - validas;
+    return validas > 0 ? 0 : -1;
+}
+
+void liberarManifiesto(Manifiesto *m) {
+    free(m->entradas);
+    m->entradas = NULL;
+    m->n = 0;
+}
+
+int filtrarManifiesto(const Manifiesto *m, const char *omitir, Manifiesto *resto) {
+    resto->entradas = malloc((m->n > 0 ? m->n : 1) * sizeof(EntradaManifiesto));
+    resto->n = 0;
+    resto->descartadas = m->descartadas;
+    if (!resto->entradas) return -1;
+    for (int i = 0; i < m->n; i++) {
+        if (!omitir[i]) resto->entradas[resto->n++] = m->entradas[i];
+    }
+    return 0;
+}
+
+long long tamanoSalidaBMP(const EntradaManifiesto *e) {
+    long long rowSize = (long long)e->ancho * 3 + (4 - (e->ancho * 3) % 4) % 4;
+    return (long long)(sizeof(BMPHeader) + sizeof(DIBHeader)) + rowSize * e->alto;
+}
+
+long long tamanoSalidaGrisesBMP(const EntradaManifiesto *e) {
+    long long rowSize = ((long long)e->ancho + 3) & ~3LL;
+    return (long long)(sizeof(BMPHeader) + sizeof(DIBHeader)) + 256 * 4 + rowSize * e->alto;
+}
+
+long long espacioNecesarioManifiesto(const Manifiesto *m, int salidasColor, int salidasGrises8,
+                                     FormatoArchivo archivo, long long bloque) {
+    long long total = 0;
+    for (int i = 0; i < m->n; i++) {
+        const EntradaManifiesto *e = &m->entradas[i];
+        long long color = tamanoSalidaBMP(e);
+        long long grises = tamanoSalidaGrisesBMP(e);
+        if (archivo == ARCHIVO_QOI) {
+            long long cabeceras = sizeof(BMPHeader) + sizeof(DIBHeader);
+            long long colorQOI = tamanoMaximoQOI(e->ancho, e->alto, 3, cabeceras);
+            long long grisesQOI = tamanoMaximoQOI(e->ancho, e->alto, 1, cabeceras + 256 * 4);
+            if (colorQOI > color) color = colorQOI;
+            if (grisesQOI > grises) grises = grisesQOI;
+        }
+        if (bloque > 0) {
+            color = (color + bloque - 1) / bloque * bloque;
+            grises = (grises + bloque - 1) / bloque * bloque;
+        }
+        total += color * salidasColor + grises * salidasGrises8;
+    }
+    return total;
+}
+
+// Ambos motores de desenfoque son O(1) por pixel, asi que el tamano solo
+// pesa cuando la ventana es mas chica que la imagen: con una ventana que cubre
+// toda la imagen el interior vectorizado desaparece y todo es borde recortado.
+// Cada kernel de la lista es una pasada de desenfoque mas.
+double costoImagen(const EntradaManifiesto *e, const ListaKernels *kernels) {
+    double pixeles = (double)e->ancho * e->alto;
+    int lado = e->ancho < e->alto ? e->ancho : e->alto;
+    double blur = 0.0;
+    for (int k = 0; k < kernels->n; k++) {
+        blur += kernels->tamanos[k] >= lado ? 2.0 * COSTO_PIXEL_BLUR : COSTO_PIXEL_BLUR;
+    }
+    return COSTO_FIJO_IMAGEN + pixeles * (COSTO_PIXEL_FILTROS + blur + PASADAS_GAUSS * COSTO_PIXEL_BLUR);
+}
+
+static const double *costosOrden;
+
+static int compararCosto(const void *a, const void *b) {
+    double ca = costosOrden[*(const int *)a], cb = costosOrden[*(const int *)b];
+    if (ca != cb) return ca > cb ? -1 : 1;
+    return *(const int *)a - *(const int *)b;
+}
+
+int *ordenarPorCosto(const Manifiesto *m, const ListaKernels *kernels) {
+    double *costos = malloc(m->n * sizeof(double));
+    int *orden = malloc(m->n * sizeof(int));
+    for (int i = 0; i < m->n; i++) {
+        costos[i] = costoImagen(&m->entradas[i], kernels);
+        orden[i] = i;
+    }
+    costosOrden = costos;
+    qsort(orden, m->n, sizeof(int), compararCosto);
+    free(costos);
+    return orden;
+}
+
+int *asignarLPT(const Manifiesto *m, const ListaKernels *kernels, int numRanks, int rank, int *cuantas) {
+    int *orden = ordenarPorCosto(m, kernels);
+    double *carga = calloc(numRanks, sizeof(double));
+    int *propias = malloc((m->n > 0 ? m->n : 1) * sizeof(int));
+    *cuantas = 0;
+
+    for (int j = 0; j < m->n; j++) {
+        int destino = 0;
+        for (int r = 1; r < numRanks; r++) {
+            if (carga[r] < carga[destino]) destino = r;
+        }
+        carga[destino] += costoImagen(&m->entradas[orden[j]], kernels);
+        if (destino == rank) propias[(*cuantas)++] = orden[j];
+    }
+
+    free(orden);
+    free(carga);
+    return propias;
+}
@@ -0,0 +1,53 @@
+// manifiesto.h
+#ifndef MANIFIESTO_H
+#define MANIFIESTO_H
+
+#include "image_processing.h"
+#include <mpi.h>
+
+#define MAX_NOMBRE_IMAGEN 256
+
+// Una imagen del directorio de entrada con los datos de su cabecera DIB
+typedef struct {
+    char nombre[MAX_NOMBRE_IMAGEN]; // nombre dentro del directorio
+    long long bytes;                // tamano del archivo
+    int ancho, alto;                // 0 si no es un BMP de 24 bits valido
+} EntradaManifiesto;
+
+typedef struct {
+    EntradaManifiesto *entradas;
+    int n;
+    int descartadas; // archivos .bmp que no son BMP de 24 bits validos o estan truncados
+} Manifiesto;
+
+// Rank 0 lista el directorio (orden natural, hasta limite archivos .bmp si
+// limite > 0) y difunde los nombres; cada rank lee las cabeceras de su tramo
+// y el resultado se reune en todos los ranks. Es colectiva sobre comm.
+// Devuelve -1 si no hay imagenes validas y MANIFIESTO_SIN_MEMORIA si falto
+// memoria para el listado.
+#define MANIFIESTO_SIN_MEMORIA -2
+int construirManifiesto(const char *directorio, int limite, MPI_Comm comm, Manifiesto *m);
+void liberarManifiesto(Manifiesto *m);
+// Copia en resto las entradas con omitir[i] == 0, en el mismo orden
+int filtrarManifiesto(const Manifiesto *m, const char *omitir, Manifiesto *resto);
+
+// Bytes de una salida BMP de 24 bits con las dimensiones de la entrada
+long long tamanoSalidaBMP(const EntradaManifiesto *e);
+// Bytes de una salida BMP de 8 bits con paleta de grises
+long long tamanoSalidaGrisesBMP(const EntradaManifiesto *e);
+// Espacio para salidasColor salidas de 24 bits y salidasGrises8 de 8 bits
+// por imagen, redondeando cada archivo al bloque del sistema de archivos:
+// exacto en BMP y con ARCHIVO_QOI la cota de tamanoMaximoQOI (o el BMP, si
+// es mayor), porque lo que comprime depende del contenido
+long long espacioNecesarioManifiesto(const Manifiesto *m, int salidasColor, int salidasGrises8,
+                                     FormatoArchivo archivo, long long bloque);
+
+// Costo relativo de procesar una imagen
+double costoImagen(const EntradaManifiesto *e, const ListaKernels *kernels);
+// Indices del manifiesto ordenados de mayor a menor costo
+int *ordenarPorCosto(const Manifiesto *m, const ListaKernels *kernels);
+// Reparto longest-processing-time-first: cada imagen, de mayor a menor costo,
+// va al rank con menos carga acumulada. Devuelve los indices de rank.
+int *asignarLPT(const Manifiesto *m, const ListaKernels *kernels, int numRanks, int rank, int *cuantas);
+
+#endif // MANIFIESTO_H
@@ -0,0 +1,202 @@
+// previas.c
+#include "previas.h"
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/uio.h>
+
+static void logError(FILE *log, const char *msg) {
+    if (log) fprintf(log, "Error: %s\n", msg);
+}
+
+static int ladoPrevias = 0;
+
+void establecerLadoPrevias(int lado) {
+    ladoPrevias = lado > 0 ? lado : 0;
+}
+
+int obtenerLadoPrevias(void) {
+    return ladoPrevias;
+}
+
+void rutaPrevia(const char *salida, char *ruta, size_t tam) {
+    const char *nombre = strrchr(salida, '/');
+    int dir = nombre ? (int)(nombre - salida) : 1;
+    const char *base = nombre ? nombre + 1 : salida;
+    const char *ext = strrchr(base, '.');
+    int largo = ext ? (int)(ext - base) : (int)strlen(base);
+    snprintf(ruta, tam, "%.*s/%s/%.*s.bmp", dir, nombre ? salida : ".", DIR_PREVIAS, largo, base);
+}
+
+// Primera columna (o fila) de la fuente del bloque i de n sobre total: los
+// bloques cubren la fuente sin huecos, difieren a lo sumo en uno y son
+// simetricos (la segunda mitad refleja a la primera), asi la previa espejada
+// es la previa de la salida espejada (salvo el borde central cuando la
+// fuente es impar y la previa par)
+static inline int inicioBloque(int i, int n, int total) {
+    if (2 * i > n) return total - (int)((long long)(n - i) * total / n);
+    return (int)((long long)i * total / n);
+}
+
+// Bloque que contiene la fila (o columna) y
+static inline int bloqueDe(int y, int n, int total) {
+    int i = (int)(((long long)(y + 1) * n - 1) / total);
+    while (i + 1 < n && inicioBloque(i + 1, n, total) <= y) i++;
+    while (i > 0 && inicioBloque(i, n, total) > y) i--;
+    return i;
+}
+
+static void liberarPrevia(Previa *p) {
+    devolverBuffer(p->arena, p->buffer);
+    free(p->sumas);
+    p->buffer = NULL;
+    p->sumas = NULL;
+}
+
+static int iniciarPrevia(Previa *p, const ImagenBMP *fuente, Arena *arena) {
+    memset(p, 0, sizeof(*p));
+    int w = fuente->dib.width, h = fuente->dib.height;
+    int mayor = w > h ? w : h;
+    int lado = ladoPrevias > 0 && ladoPrevias < mayor ? ladoPrevias : mayor;
+    int pw = (int)((long long)w * lado / mayor), ph = (int)((long long)h * lado / mayor);
+    if (pw < 1) pw = 1;
+    if (ph < 1) ph = 1;
+
+    p->anchoFuente = w;
+    p->altoFuente = h;
+    p->arena = arena;
+    p->img.header = fuente->header;
+    p->img.dib = fuente->dib;
+    p->img.dib.width = pw;
+    p->img.dib.height = ph;
+    p->img.padding = (4 - (pw * 3) % 4) % 4;
+    p->img.rowSize = (size_t)pw * 3 + p->img.padding;
+    p->img.imageSize = p->img.rowSize * ph;
+    p->buffer = pedirBuffer(arena, p->img.imageSize);
+    p->sumas = calloc((size_t)pw * ph * 3, sizeof(*p->sumas));
+    if (!p->buffer || !p->sumas) {
+        liberarPrevia(p);
+        return -1;
+    }
+    memset(p->buffer, 0, p->img.imageSize); // el relleno queda en cero
+    p->img.pixeles = p->buffer;
+    return 0;
+}
+
+int iniciarPrevias(PreviasImagen *p, const ImagenBMP *fuente, int numKernels, Arena *arena) {
+    memset(p, 0, sizeof(*p));
+    p->numKernels = numKernels;
+    int fallo = iniciarPrevia(&p->entrada, fuente, arena) != 0 || iniciarPrevia(&p->gauss, fuente, arena) != 0;
+    for (int k = 0; k < numKernels && !fallo; k++) fallo = iniciarPrevia(&p->desenfoques[k], fuente, arena) != 0;
+    if (fallo) {
+        liberarPrevias(p);
+        return -1;
+    }
+    return 0;
+}
+
+void liberarPrevias(PreviasImagen *p) {
+    liberarPrevia(&p->entrada);
+    liberarPrevia(&p->gauss);
+    for (int k = 0; k < p->numKernels; k++) liberarPrevia(&p->desenfoques[k]);
+}
+
+void acumularFilasPrevia(Previa *p, const uint8_t *base, int origen, int modulo, size_t rowSize, int a, int b) {
+    int pw = p->img.dib.width, ph = p->img.dib.height;
+    int w = p->anchoFuente, h = p->altoFuente;
+
+    // Cada hilo suma sus columnas de la previa en todas las filas
+    #pragma omp parallel for schedule(static)
+    for (int px = 0; px < pw; px++) {
+        int x0 = inicioBloque(px, pw, w), x1 = inicioBloque(px + 1, pw, w);
+        for (int y = a; y < b; y++) {
+            int py = bloqueDe(y, ph, h);
+            const uint8_t *src = base + (size_t)((y - origen) % modulo) * rowSize;
+            unsigned long long *s = p->sumas + ((size_t)py * pw + px) * 3;
+            for (int x = x0; x < x1; x++) {
+                s[0] += src[x * 3 + 0];
+                s[1] += src[x * 3 + 1];
+                s[2] += src[x * 3 + 2];
+            }
+        }
+    }
+}
+
+// Promedio redondeado de cada bloque en buffer
+static void terminarAcumulacion(Previa *p) {
+    int pw = p->img.dib.width, ph = p->img.dib.height;
+    for (int py = 0; py < ph; py++) {
+        int y0 = inicioBloque(py, ph, p->altoFuente), y1 = inicioBloque(py + 1, ph, p->altoFuente);
+        uint8_t *fila = p->buffer + py * p->img.rowSize;
+        for (int px = 0; px < pw; px++) {
+            int x0 = inicioBloque(px, pw, p->anchoFuente), x1 = inicioBloque(px + 1, pw, p->anchoFuente);
+            unsigned long long area = (unsigned long long)(x1 - x0) * (y1 - y0);
+            const unsigned long long *s = p->sumas + ((size_t)py * pw + px) * 3;
+            for (int c = 0; c < 3; c++) fila[px * 3 + c] = (uint8_t)((s[c] + area / 2) / area);
+        }
+    }
+}
+
+// BMP de 24 bits aunque las salidas sean QOI: la interfaz los abre directo.
+// Archivo nuevo en lugar de truncar, como las salidas.
+static long long escribirBMPPrevia(const char *ruta, const ImagenBMP *img, const uint8_t *pixeles) {
+    BMPHeader header = img->header;
+    DIBHeader dib = img->dib;
+    header.size = sizeof(BMPHeader) + sizeof(DIBHeader) + img->imageSize;
+    header.offset = sizeof(BMPHeader) + sizeof(DIBHeader);
+    dib.size = sizeof(DIBHeader);
+    dib.imageSize = img->imageSize;
+
+    unlink(ruta);
+    int fd = open(ruta, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) return -1;
+    struct iovec iov[3] = {
+        { &header, sizeof(header) }, { &dib, sizeof(dib) }, { (void *)pixeles, img->imageSize }
+    };
+    ssize_t escritos = writev(fd, iov, 3);
+    int error = escritos != (ssize_t)header.size || fdatasync(fd) != 0;
+    if (close(fd) != 0 || error) {
+        unlink(ruta);
+        return -1;
+    }
+    return header.size;
+}
+
+long long escribirPrevias(PreviasImagen *p, const char *salidas[MAX_RUTAS_SALIDA], FILE *log) {
+    terminarAcumulacion(&p->entrada);
+    terminarAcumulacion(&p->gauss);
+    for (int k = 0; k < p->numKernels; k++) terminarAcumulacion(&p->desenfoques[k]);
+
+    const ImagenBMP *img = &p->entrada.img;
+    uint8_t *tmp = pedirBuffer(p->entrada.arena, img->imageSize);
+    if (!tmp) {
+        logError(log, "Memoria insuficiente.");
+        return -1;
+    }
+    long long total = 0;
+    int fallo = 0;
+    char ruta[1024];
+    for (int s = 0; s < NUM_SALIDAS + p->numKernels - 1 && !fallo; s++) {
+        const uint8_t *pixeles = tmp;
+        if (s == SALIDA_HG || s == SALIDA_VG || s == SALIDA_GRIS) {
+            convertirGrisesBGR(img, tmp, s == SALIDA_HG, s == SALIDA_VG);
+        } else if (s == SALIDA_HC) {
+            espejoHorizontalColor(img, tmp);
+        } else if (s == SALIDA_VC) {
+            espejoVerticalColor(img, tmp);
+        } else if (s == SALIDA_GAUSS) {
+            pixeles = p->gauss.buffer;
+        } else {
+            pixeles = p->desenfoques[s == SALIDA_BLUR ? 0 : s - NUM_SALIDAS + 1].buffer;
+        }
+        if (p->omitidas[s]) continue;
+        rutaPrevia(salidas[s], ruta, sizeof(ruta));
+        long long bytes = escribirBMPPrevia(ruta, img, pixeles);
+        if (bytes < 0) {
+            logError(log, "No se pudo escribir la previa.");
+            fallo = 1;
+        }
+        total += bytes;
+    }
+    devolverBuffer(p->entrada.arena, tmp);
+    return fallo ? -1 : total;
+}
@@ -0,0 +1,59 @@
+// previas.h
+#ifndef PREVIAS_H
+#define PREVIAS_H
+
+#include "image_processing.h"
+
+// Previas: una miniatura BMP de 24 bits por salida, en <dirSalida>/previas/
+// con el nombre de la salida, para que la interfaz no tenga que leer las
+// imagenes completas. Cada pixel de una previa es el promedio de area de su
+// bloque. La de la entrada se suma de las filas leidas y de ella salen los
+// espejos y los grises (promediar conmuta con espejar); las de los
+// desenfoques y del gaussiano se suman de las filas de cada salida a medida
+// que se calculan. Asi las previas son las mismas con cualquier motor de
+// desenfoque y con o sin franjas.
+
+#define DIR_PREVIAS "previas"
+#define LADO_PREVIA 120 // lado mayor por defecto, el de las miniaturas de main.py
+#define MAX_LADO_PREVIA 4096 // tope de --previas=LADO
+
+typedef struct {
+    ImagenBMP img;          // la fuente reducida; pixeles apunta a buffer
+    uint8_t *buffer;
+    int anchoFuente, altoFuente;
+    unsigned long long *sumas; // B, G, R por pixel de la previa
+    Arena *arena;
+} Previa;
+
+// Las previas de una imagen: la entrada y cada salida que no se deriva de ella
+typedef struct {
+    Previa entrada;
+    Previa desenfoques[MAX_KERNELS]; // una por kernel, como RUTA_DESENFOQUE
+    Previa gauss;
+    int numKernels;
+    int omitidas[MAX_RUTAS_SALIDA]; // salidas que fallaron: no tienen previa
+} PreviasImagen;
+
+// lado 0 (por defecto) = sin previas
+void establecerLadoPrevias(int lado);
+int obtenerLadoPrevias(void);
+
+// <dir>/previas/<nombre>.bmp para la salida <dir>/<nombre>.<ext>
+void rutaPrevia(const char *salida, char *ruta, size_t tam);
+
+// Previas de lado mayor obtenerLadoPrevias() (sin agrandar) de una entrada
+// con las cabeceras de fuente; -1 sin memoria
+int iniciarPrevias(PreviasImagen *p, const ImagenBMP *fuente, int numKernels, Arena *arena);
+void liberarPrevias(PreviasImagen *p);
+
+// Suma las filas [a, b) de la fuente, la fila y en base + ((y - origen) %
+// modulo) * rowSize como en el camino por franjas
+void acumularFilasPrevia(Previa *p, const uint8_t *base, int origen, int modulo, size_t rowSize, int a, int b);
+
+// Divide las sumas (cuando ya pasaron todas las filas) y escribe la previa
+// de cada una de las salidas (indexadas como en procesarImagenBMP) que no
+// este en omitidas.
+// Devuelve los bytes escritos o -1 si alguna fallo.
+long long escribirPrevias(PreviasImagen *p, const char *salidas[MAX_RUTAS_SALIDA], FILE *log);
+
+#endif // PREVIAS_H
@@ -0,0 +1,114 @@
+// progreso.c
+#include "progreso.h"
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Peso de la muestra nueva en el promedio movil de la velocidad
+#define PESO_MUESTRA 0.3
+
+int iniciarProgreso(Progreso *p, const Manifiesto *m, double intervalo) {
+    memset(p, 0, sizeof(*p));
+    MPI_Comm_rank(MPI_COMM_WORLD, &p->rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &p->size);
+    p->intervalo = intervalo;
+    p->tInicio = p->tLinea = p->tUltima = MPI_Wtime();
+    p->req = MPI_REQUEST_NULL;
+    if (p->rank != 0) return 0;
+    p->totalImagenes = m->n;
+    for (int i = 0; i < m->n; i++) p->totalBytes += (unsigned long long)m->entradas[i].bytes;
+    p->porRank = calloc(p->size, sizeof(*p->porRank));
+    return p->porRank ? 0 : -1;
+}
+
+static void imprimirLinea(Progreso *p, int fin) {
+    unsigned long long imagenes = 0, bytes = 0;
+    for (int r = 0; r < p->size; r++) {
+        imagenes += p->porRank[r][0];
+        bytes    += p->porRank[r][1];
+    }
+    double ahora = MPI_Wtime();
+
+    // La velocidad se mide en ventanas de al menos un intervalo que terminan
+    // con imagenes nuevas: con imagenes mas lentas que el intervalo no cae a
+    // cero entre una y otra, y un mensaje que llega justo despues de una
+    // linea no da un pico
+    double dt = ahora - p->tUltima;
+    if (imagenes > p->imagenesUltima && dt >= p->intervalo) {
+        double v  = (bytes - p->bytesUltima) / dt;
+        double vi = (imagenes - p->imagenesUltima) / dt;
+        double peso = p->muestras ? PESO_MUESTRA : 1.0;
+        p->velocidad         += peso * (v - p->velocidad);
+        p->velocidadImagenes += peso * (vi - p->velocidadImagenes);
+        p->muestras++;
+        p->tUltima = ahora;
+        p->bytesUltima = bytes;
+        p->imagenesUltima = imagenes;
+    }
+    // La linea final lleva el promedio de toda la corrida
+    double total = ahora - p->tInicio;
+    if (fin && total > 0) {
+        p->velocidad = bytes / total;
+        p->velocidadImagenes = imagenes / total;
+    }
+
+    unsigned long long resto = p->totalBytes > bytes ? p->totalBytes - bytes : 0;
+    double eta = fin ? 0 : p->velocidad > 0 ? resto / p->velocidad : -1;
+    printf("PROGRESO imagenes=%llu/%d bytes=%llu/%llu mb_s=%.1f img_s=%.2f eta_s=%.1f t=%.2f%s\n", imagenes,
+           p->totalImagenes, bytes, p->totalBytes, p->velocidad / (1024.0 * 1024.0), p->velocidadImagenes, eta,
+           total, fin ? " fin=1" : "");
+    fflush(stdout);
+    p->tLinea = ahora;
+}
+
+void atenderProgreso(Progreso *p) {
+    if (p->rank != 0) return;
+    memcpy(p->porRank[0], p->propio, sizeof(p->propio));
+    for (;;) {
+        int hay;
+        MPI_Status status;
+        MPI_Iprobe(MPI_ANY_SOURCE, TAG_PROGRESO, MPI_COMM_WORLD, &hay, &status);
+        if (!hay) break;
+        // Totales acumulados: el ultimo mensaje de cada rank reemplaza al anterior
+        MPI_Recv(p->porRank[status.MPI_SOURCE], 3, MPI_UNSIGNED_LONG_LONG, status.MPI_SOURCE, TAG_PROGRESO,
+                 MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+    }
+    if (MPI_Wtime() - p->tLinea >= p->intervalo) imprimirLinea(p, 0);
+}
+
+void avanzarProgreso(Progreso *p, long long bytes) {
+    p->propio[0]++;
+    p->propio[1] += (unsigned long long)bytes;
+    if (p->rank == 0) {
+        atenderProgreso(p);
+        return;
+    }
+    int listo;
+    MPI_Test(&p->req, &listo, MPI_STATUS_IGNORE);
+    if (!listo) return; // rank 0 todavia no tomo el anterior
+    memcpy(p->enviado, p->propio, sizeof(p->propio));
+    MPI_Isend(p->enviado, 3, MPI_UNSIGNED_LONG_LONG, 0, TAG_PROGRESO, MPI_COMM_WORLD, &p->req);
+}
+
+void terminarProgreso(Progreso *p) {
+    p->propio[2] = 1;
+    if (p->rank != 0) {
+        MPI_Wait(&p->req, MPI_STATUS_IGNORE);
+        memcpy(p->enviado, p->propio, sizeof(p->propio));
+        MPI_Send(p->enviado, 3, MPI_UNSIGNED_LONG_LONG, 0, TAG_PROGRESO, MPI_COMM_WORLD);
+        return;
+    }
+
+    // Rank 0 ya no calcula: sondea cada 10 ms hasta que todos terminaron
+    struct timespec espera = { 0, 10 * 1000 * 1000 };
+    for (;;) {
+        atenderProgreso(p);
+        int faltan = 0;
+        for (int r = 0; r < p->size; r++) faltan += !p->porRank[r][2];
+        if (!faltan) break;
+        nanosleep(&espera, NULL);
+    }
+    imprimirLinea(p, 1);
+    free(p->porRank);
+    p->porRank = NULL;
+}
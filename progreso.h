@@ -0,0 +1,54 @@
+// progreso.h
+#ifndef PROGRESO_H
+#define PROGRESO_H
+
+#include "manifiesto.h"
+#include <mpi.h>
+#include <stdio.h>
+
+// Canal de progreso del lote: cada rank manda a rank 0 sus totales
+// acumulados (imagenes y bytes de entrada) con mensajes no bloqueantes y
+// rank 0 imprime en stdout, cada cierto intervalo, una linea por muestra:
+//
+//   PROGRESO imagenes=12/40 bytes=301989888/1006632960 mb_s=85.3 img_s=3.41 eta_s=8.3 t=3.52
+//
+// mb_s e img_s son la velocidad reciente (promedio movil de las ultimas
+// muestras) y eta_s los bytes que faltan a esa velocidad. La ultima linea
+// lleva fin=1 y la velocidad promedio de la corrida; eta_s es -1 mientras
+// no hay velocidad. Nadie espera a que rank 0 reciba: si el envio anterior
+// de un rank sigue en vuelo, ese rank se saltea la muestra y la siguiente
+// lleva los totales al dia.
+
+#define TAG_PROGRESO 3 // rank -> rank 0: {imagenes, bytes, fin}
+
+typedef struct {
+    int rank, size;
+    double intervalo;                // segundos entre lineas
+    double tInicio;
+    unsigned long long propio[3];    // imagenes, bytes, fin de este rank
+    // Ranks distintos de 0: envio en vuelo
+    unsigned long long enviado[3];
+    MPI_Request req;
+    // Rank 0
+    int totalImagenes;
+    unsigned long long totalBytes;
+    unsigned long long (*porRank)[3]; // ultimos totales recibidos de cada rank
+    double tLinea;                   // ultima linea impresa
+    double tUltima;                  // ultima muestra con imagenes nuevas
+    unsigned long long bytesUltima, imagenesUltima;
+    double velocidad, velocidadImagenes; // bytes/s e imagenes/s, promedio movil
+    int muestras;
+} Progreso;
+
+// m son las imagenes que faltan procesar, el mismo en todos los ranks
+int iniciarProgreso(Progreso *p, const Manifiesto *m, double intervalo);
+// Suma una imagen terminada de bytes de entrada; en rank 0 ademas atiende
+// los mensajes llegados e imprime si paso el intervalo
+void avanzarProgreso(Progreso *p, long long bytes);
+// Rank 0: atiende los mensajes llegados sin bloquear
+void atenderProgreso(Progreso *p);
+// Cada rank avisa que termino; rank 0 sigue imprimiendo hasta que todos lo
+// hicieron y deja la linea final
+void terminarProgreso(Progreso *p);
+
+#endif // PROGRESO_H
@@ -0,0 +1,356 @@
+// qoi.c
+#include "qoi.h"
+#include <fcntl.h>
+#include <omp.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define QOI_OP_INDEX 0x00 // 00iiiiii
+#define QOI_OP_DIFF  0x40 // 01rrggbb, -2..1 por canal
+#define QOI_OP_LUMA  0x80 // 10gggggg + rrrrbbbb relativos a g
+#define QOI_OP_RUN   0xc0 // 11nnnnnn, 1..62 repeticiones
+#define QOI_OP_RGB   0xfe // + r, g, b
+#define QOI_OP_GRIS  0xff // + g, solo con un canal (en QOI es RGBA)
+#define QOI_MASCARA  0xc0
+
+#define HASH_QOI(r, g, b) (((r) * 3 + (g) * 5 + (b) * 7 + 255 * 11) % 64)
+
+static void logError(FILE *log, const char *msg) {
+    if (log) {
+        fprintf(log, "ERROR: %s\n", msg);
+        fflush(log);
+    }
+}
+
+static int pwriteCompleto(int fd, const uint8_t *buf, size_t len, off_t offset) {
+    while (len > 0) {
+        ssize_t escritos = pwrite(fd, buf, len, offset);
+        if (escritos <= 0) return -1;
+        buf += escritos;
+        len -= escritos;
+        offset += escritos;
+    }
+    return 0;
+}
+
+// Codifica n filas de ancho pixeles con el estado inicial de QOI; dst debe
+// tener lugar para 4 bytes por pixel (el peor caso, todo RGB literal)
+static size_t codificarBanda(const uint8_t *const *filas, int n, int ancho, int canales, uint8_t *dst) {
+    uint8_t indice[64][3];
+    memset(indice, 0, sizeof(indice));
+    int pr = 0, pg = 0, pb = 0, corrida = 0;
+    size_t p = 0;
+
+    for (int k = 0; k < n; k++) {
+        const uint8_t *fila = filas[k];
+        for (int x = 0; x < ancho; x++) {
+            int r, g, b;
+            if (canales == 3) {
+                b = fila[x * 3 + 0];
+                g = fila[x * 3 + 1];
+                r = fila[x * 3 + 2];
+            } else {
+                r = g = b = fila[x];
+            }
+
+            if (r == pr && g == pg && b == pb) {
+                if (++corrida == 62) {
+                    dst[p++] = QOI_OP_RUN | (corrida - 1);
+                    corrida = 0;
+                }
+                continue;
+            }
+            if (corrida > 0) {
+                dst[p++] = QOI_OP_RUN | (corrida - 1);
+                corrida = 0;
+            }
+
+            int h = HASH_QOI(r, g, b);
+            if (indice[h][0] == r && indice[h][1] == g && indice[h][2] == b) {
+                dst[p++] = QOI_OP_INDEX | h;
+            } else {
+                indice[h][0] = r;
+                indice[h][1] = g;
+                indice[h][2] = b;
+                // Diferencias modulo 256, como en QOI
+                int dr = (int8_t)(r - pr), dg = (int8_t)(g - pg), db = (int8_t)(b - pb);
+                int drg = dr - dg, dbg = db - dg;
+                if (dr >= -2 && dr <= 1 && dg >= -2 && dg <= 1 && db >= -2 && db <= 1) {
+                    dst[p++] = QOI_OP_DIFF | (dr + 2) << 4 | (dg + 2) << 2 | (db + 2);
+                } else if (dg >= -32 && dg <= 31 && drg >= -8 && drg <= 7 && dbg >= -8 && dbg <= 7) {
+                    dst[p++] = QOI_OP_LUMA | (dg + 32);
+                    dst[p++] = (drg + 8) << 4 | (dbg + 8);
+                } else if (canales == 1) {
+                    dst[p++] = QOI_OP_GRIS;
+                    dst[p++] = g;
+                } else {
+                    dst[p++] = QOI_OP_RGB;
+                    dst[p++] = r;
+                    dst[p++] = g;
+                    dst[p++] = b;
+                }
+            }
+            pr = r;
+            pg = g;
+            pb = b;
+        }
+    }
+    if (corrida > 0) dst[p++] = QOI_OP_RUN | (corrida - 1);
+    return p;
+}
+
+// Inversa de codificarBanda; filas de rowSize bytes desde dst, con el
+// relleno en cero. -1 si los datos no alcanzan o sobran
+static int decodificarBanda(const uint8_t *src, size_t len, int n, int ancho, int canales, uint8_t *dst, size_t rowSize) {
+    uint8_t indice[64][3];
+    memset(indice, 0, sizeof(indice));
+    int r = 0, g = 0, b = 0, corrida = 0;
+    size_t p = 0;
+
+    for (int k = 0; k < n; k++) {
+        uint8_t *fila = dst + (size_t)k * rowSize;
+        for (int x = 0; x < ancho; x++) {
+            if (corrida > 0) {
+                corrida--;
+            } else {
+                if (p >= len) return -1;
+                int op = src[p++];
+                if (op == QOI_OP_RGB) {
+                    if (p + 3 > len) return -1;
+                    r = src[p];
+                    g = src[p + 1];
+                    b = src[p + 2];
+                    p += 3;
+                } else if (op == QOI_OP_GRIS) {
+                    if (p >= len) return -1;
+                    r = g = b = src[p++];
+                } else if ((op & QOI_MASCARA) == QOI_OP_INDEX) {
+                    r = indice[op][0];
+                    g = indice[op][1];
+                    b = indice[op][2];
+                } else if ((op & QOI_MASCARA) == QOI_OP_DIFF) {
+                    r = (r + ((op >> 4) & 3) - 2) & 0xff;
+                    g = (g + ((op >> 2) & 3) - 2) & 0xff;
+                    b = (b + (op & 3) - 2) & 0xff;
+                } else if ((op & QOI_MASCARA) == QOI_OP_LUMA) {
+                    if (p >= len) return -1;
+                    int dg = (op & 0x3f) - 32, extra = src[p++];
+                    r = (r + dg + (extra >> 4) - 8) & 0xff;
+                    g = (g + dg) & 0xff;
+                    b = (b + dg + (extra & 0x0f) - 8) & 0xff;
+                } else {
+                    corrida = op & 0x3f;
+                }
+                int h = HASH_QOI(r, g, b);
+                indice[h][0] = r;
+                indice[h][1] = g;
+                indice[h][2] = b;
+            }
+            if (canales == 3) {
+                fila[x * 3 + 0] = b;
+                fila[x * 3 + 1] = g;
+                fila[x * 3 + 2] = r;
+            } else {
+                fila[x] = g;
+            }
+        }
+        memset(fila + (size_t)ancho * canales, 0, rowSize - (size_t)ancho * canales);
+    }
+    return corrida == 0 && p == len ? 0 : -1;
+}
+
+int abrirEscritorQOI(EscritorQOI *q, const char *ruta, const uint8_t *cabeceras, size_t tamCabeceras,
+                     int ancho, int alto, int canales) {
+    memset(q, 0, sizeof(*q));
+    memcpy(q->cabecera.magia, MAGIA_QOI, 4);
+    q->cabecera.ancho = ancho;
+    q->cabecera.alto = alto;
+    q->cabecera.canales = canales;
+    q->cabecera.version = VERSION_QOI;
+    q->cabecera.tamCabeceras = tamCabeceras;
+    q->hilos = omp_get_max_threads();
+    q->tamBuffer = (size_t)FILAS_BANDA_QOI * ancho * 4 + 1;
+    q->buffers = malloc(q->hilos * q->tamBuffer);
+    unlink(ruta); // archivo nuevo: la ruta anterior puede estar enlazada desde la cache
+    q->fd = open(ruta, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    q->offset = sizeof(CabeceraQOI) + tamCabeceras;
+    if (!q->buffers || q->fd < 0 || pwriteCompleto(q->fd, cabeceras, tamCabeceras, sizeof(CabeceraQOI)) != 0) {
+        if (q->fd >= 0) close(q->fd);
+        free(q->buffers);
+        q->buffers = NULL;
+        q->fd = -1;
+        return -1;
+    }
+    return 0;
+}
+
+int agregarFilasQOI(EscritorQOI *q, int fila0, int n, const uint8_t *const *filas) {
+    int numBandas = (n + FILAS_BANDA_QOI - 1) / FILAS_BANDA_QOI;
+    if (q->error) return -1;
+    if (q->cabecera.numBandas + numBandas > (uint32_t)q->capacidadBandas) {
+        int capacidad = q->capacidadBandas ? q->capacidadBandas : 64;
+        while ((uint32_t)capacidad < q->cabecera.numBandas + numBandas) capacidad *= 2;
+        BandaQOI *bandas = realloc(q->bandas, capacidad * sizeof(BandaQOI));
+        if (!bandas) return q->error = -1;
+        q->bandas = bandas;
+        q->capacidadBandas = capacidad;
+    }
+
+    // De a una banda por hilo: se codifican en paralelo y se escriben en orden
+    size_t longitudes[q->hilos];
+    for (int base = 0; base < numBandas; base += q->hilos) {
+        int lote = numBandas - base < q->hilos ? numBandas - base : q->hilos;
+        #pragma omp parallel for schedule(static) num_threads(lote)
+        for (int i = 0; i < lote; i++) {
+            int a = (base + i) * FILAS_BANDA_QOI;
+            int filasBanda = n - a < FILAS_BANDA_QOI ? n - a : FILAS_BANDA_QOI;
+            uint8_t *buffer = q->buffers + i * q->tamBuffer;
+            longitudes[i] = codificarBanda(filas + a, filasBanda, q->cabecera.ancho, q->cabecera.canales, buffer);
+            size_t bytesFila = (size_t)q->cabecera.ancho * q->cabecera.canales;
+            if (longitudes[i] >= bytesFila * filasBanda) {
+                for (int k = 0; k < filasBanda; k++) memcpy(buffer + k * bytesFila, filas[a + k], bytesFila);
+                longitudes[i] = bytesFila * filasBanda;
+            }
+        }
+        for (int i = 0; i < lote; i++) {
+            int a = (base + i) * FILAS_BANDA_QOI;
+            BandaQOI *b = &q->bandas[q->cabecera.numBandas++];
+            b->fila = fila0 + a;
+            b->filas = n - a < FILAS_BANDA_QOI ? n - a : FILAS_BANDA_QOI;
+            b->offset = q->offset;
+            b->longitud = longitudes[i];
+            if (pwriteCompleto(q->fd, q->buffers + i * q->tamBuffer, longitudes[i], q->offset) != 0) return q->error = -1;
+            q->offset += longitudes[i];
+        }
+    }
+    return 0;
+}
+
+long long cerrarEscritorQOI(EscritorQOI *q) {
+    if (q->fd < 0) return -1;
+    q->cabecera.offsetTabla = q->offset;
+    size_t tamTabla = q->cabecera.numBandas * sizeof(BandaQOI);
+    if (!q->error && (pwriteCompleto(q->fd, (const uint8_t *)q->bandas, tamTabla, q->offset) != 0
+                      || pwriteCompleto(q->fd, (const uint8_t *)&q->cabecera, sizeof(CabeceraQOI), 0) != 0)) {
+        q->error = -1;
+    }
+    // Vuelca antes de cerrar, asi un error de escritura diferida cuenta
+    if (fdatasync(q->fd) != 0) q->error = -1;
+    if (close(q->fd) != 0) q->error = -1;
+    q->fd = -1;
+    free(q->bandas);
+    free(q->buffers);
+    q->bandas = NULL;
+    q->buffers = NULL;
+    return q->error ? -1 : (long long)(q->offset + tamTabla);
+}
+
+long long tamanoMaximoQOI(int ancho, int alto, int canales, size_t tamCabeceras) {
+    long long bandas = ((long long)alto + FILAS_BANDA_QOI - 1) / FILAS_BANDA_QOI;
+    return (long long)sizeof(CabeceraQOI) + (long long)tamCabeceras + (long long)ancho * canales * alto
+         + bandas * (long long)sizeof(BandaQOI);
+}
+
+int validarArchivoQOI(const char *ruta, int ancho, int alto, int canales) {
+    int fd = open(ruta, O_RDONLY);
+    if (fd < 0) return -1;
+    struct stat st;
+    CabeceraQOI c;
+    int valido = fstat(fd, &st) == 0 && pread(fd, &c, sizeof(c), 0) == (ssize_t)sizeof(c)
+              && memcmp(c.magia, MAGIA_QOI, 4) == 0 && (c.version == 1 || c.version == VERSION_QOI)
+              && c.ancho == (uint32_t)ancho && c.alto == (uint32_t)alto && c.canales == canales
+              && sizeof(CabeceraQOI) + c.tamCabeceras <= c.offsetTabla
+              && c.numBandas <= ((uint64_t)alto + FILAS_BANDA_QOI - 1) / FILAS_BANDA_QOI
+              && c.offsetTabla + (uint64_t)c.numBandas * sizeof(BandaQOI) == (uint64_t)st.st_size;
+    BandaQOI *bandas = valido ? malloc(((size_t)c.numBandas + 1) * sizeof(BandaQOI)) : NULL;
+    uint8_t *cubiertas = valido ? calloc(alto, 1) : NULL;
+    size_t tamTabla = valido ? c.numBandas * sizeof(BandaQOI) : 0;
+    valido = bandas && cubiertas && pread(fd, bandas, tamTabla, c.offsetTabla) == (ssize_t)tamTabla;
+    close(fd);
+
+    // Cada banda dentro de los datos y cada fila en exactamente una banda
+    uint64_t inicioDatos = sizeof(CabeceraQOI) + c.tamCabeceras;
+    for (uint32_t i = 0; valido && i < c.numBandas; i++) {
+        const BandaQOI *b = &bandas[i];
+        valido = b->offset >= inicioDatos && b->offset <= c.offsetTabla && b->longitud <= c.offsetTabla - b->offset
+              && b->filas > 0 && b->fila < (uint32_t)alto && b->filas <= (uint32_t)alto - b->fila;
+        for (uint32_t y = b->fila; valido && y < b->fila + b->filas; y++) valido = !cubiertas[y]++;
+    }
+    for (int y = 0; valido && y < alto; y++) valido = cubiertas[y];
+    free(bandas);
+    free(cubiertas);
+    return valido ? 0 : -1;
+}
+
+int decodificarQOI(const char *entrada, const char *salida, FILE *log) {
+    int fd = open(entrada, O_RDONLY);
+    if (fd < 0) { logError(log, "No se pudo abrir el archivo QOI."); return -1; }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(CabeceraQOI)) {
+        close(fd);
+        logError(log, "Archivo QOI truncado.");
+        return -1;
+    }
+    size_t tam = st.st_size;
+    uint8_t *datos = mmap(NULL, tam, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (datos == MAP_FAILED) { logError(log, "No se pudo mapear el archivo QOI."); return -1; }
+
+    CabeceraQOI c;
+    memcpy(&c, datos, sizeof(c));
+    const BandaQOI *bandas = (const BandaQOI *)(datos + c.offsetTabla);
+    int valido = memcmp(c.magia, MAGIA_QOI, 4) == 0 && (c.version == 1 || c.version == VERSION_QOI)
+              && (c.canales == 1 || c.canales == 3) && c.ancho > 0
+              && sizeof(CabeceraQOI) + c.tamCabeceras <= c.offsetTabla
+              && c.offsetTabla <= tam && (tam - c.offsetTabla) / sizeof(BandaQOI) >= c.numBandas;
+    for (uint32_t i = 0; valido && i < c.numBandas; i++) {
+        valido = bandas[i].offset <= tam && bandas[i].longitud <= tam - bandas[i].offset
+              && bandas[i].fila <= c.alto && bandas[i].filas <= c.alto - bandas[i].fila;
+    }
+    if (!valido) {
+        munmap(datos, tam);
+        logError(log, "Archivo QOI invalido.");
+        return -1;
+    }
+
+    size_t rowSize = ((size_t)c.ancho * c.canales + 3) & ~(size_t)3;
+    size_t tamSalida = c.tamCabeceras + rowSize * c.alto;
+    int out = open(salida, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    uint8_t *mapa = MAP_FAILED;
+    if (out >= 0 && ftruncate(out, tamSalida) == 0) {
+        mapa = mmap(NULL, tamSalida, PROT_READ | PROT_WRITE, MAP_SHARED, out, 0);
+    }
+    if (mapa == MAP_FAILED) {
+        if (out >= 0) close(out);
+        munmap(datos, tam);
+        logError(log, "No se pudo crear la imagen de salida.");
+        return -1;
+    }
+
+    memcpy(mapa, datos + sizeof(CabeceraQOI), c.tamCabeceras);
+    int fallos = 0;
+    #pragma omp parallel for schedule(dynamic) reduction(+:fallos)
+    for (uint32_t i = 0; i < c.numBandas; i++) {
+        const BandaQOI *b = &bandas[i];
+        uint8_t *dst = mapa + c.tamCabeceras + (size_t)b->fila * rowSize;
+        size_t bytesFila = (size_t)c.ancho * c.canales;
+        if (c.version >= 2 && b->longitud == bytesFila * b->filas) {
+            // Banda cruda (la version 1 no las tiene)
+            for (uint32_t k = 0; k < b->filas; k++) {
+                memcpy(dst + k * rowSize, datos + b->offset + k * bytesFila, bytesFila);
+                memset(dst + k * rowSize + bytesFila, 0, rowSize - bytesFila);
+            }
+            continue;
+        }
+        fallos += decodificarBanda(datos + b->offset, b->longitud, b->filas, c.ancho, c.canales, dst, rowSize) != 0;
+    }
+
+    munmap(mapa, tamSalida);
+    close(out);
+    munmap(datos, tam);
+    if (fallos) { logError(log, "Archivo QOI corrupto."); return -1; }
+    return 0;
+}
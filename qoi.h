@@ -0,0 +1,80 @@
+// qoi.h
+#ifndef QOI_H
+#define QOI_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/types.h>
+
+// Codec sin perdida al estilo QOI (https://qoiformat.org) para las salidas:
+// las mismas operaciones (indice de 64 colores, diferencias chicas, luma,
+// corridas y RGB literal, mas un gris literal de 2 bytes para las salidas
+// de 8 bits) pero por bandas de filas independientes, asi cada banda se
+// codifica y decodifica en paralelo y una franja se puede agregar en cuanto
+// esta lista, en cualquier orden de filas.
+//
+// Archivo: CabeceraQOI, las cabeceras del BMP original tal cual (para
+// reconstruirlo byte por byte), las bandas y al final la tabla de bandas.
+// Las filas del BMP reconstruido se rellenan con ceros hasta 4 bytes.
+//
+// Una banda que codificada no ocupa menos que sus pixeles crudos (ruido, donde
+// casi todo es RGB literal de 4 bytes) se guarda cruda: en la version 2 una
+// banda con longitud == filas * ancho * canales son los pixeles sin relleno.
+// Asi el archivo nunca pasa de tamanoMaximoQOI, apenas mas que el BMP.
+
+#define MAGIA_QOI "QOIB"
+#define VERSION_QOI 2
+#define FILAS_BANDA_QOI 32
+
+#pragma pack(push, 1)
+typedef struct {
+    char magia[4];
+    uint32_t ancho, alto;
+    uint8_t canales;         // 3 (BGR) o 1 (gris de 8 bits)
+    uint8_t version;
+    uint16_t tamCabeceras;   // bytes de cabeceras BMP que siguen
+    uint32_t numBandas;
+    uint64_t offsetTabla;
+} CabeceraQOI;
+
+typedef struct {
+    uint32_t fila;           // primera fila (en el orden del BMP) de la banda
+    uint32_t filas;
+    uint64_t offset, longitud;
+} BandaQOI;
+#pragma pack(pop)
+
+typedef struct {
+    int fd;
+    CabeceraQOI cabecera;
+    BandaQOI *bandas;
+    int capacidadBandas;
+    off_t offset;            // donde va la proxima banda
+    int hilos;
+    size_t tamBuffer;        // peor caso de una banda
+    uint8_t *buffers;        // uno por hilo
+    int error;
+} EscritorQOI;
+
+// Crea el archivo; cabeceras son las del BMP que se reconstruira
+int abrirEscritorQOI(EscritorQOI *q, const char *ruta, const uint8_t *cabeceras, size_t tamCabeceras,
+                     int ancho, int alto, int canales);
+// Agrega las filas [fila0, fila0 + n) del BMP; la fila fila0 + k esta en filas[k]
+int agregarFilasQOI(EscritorQOI *q, int fila0, int n, const uint8_t *const *filas);
+// Escribe la tabla y la cabecera; devuelve el tamano del archivo o -1
+long long cerrarEscritorQOI(EscritorQOI *q);
+
+// Cota del archivo para una imagen de ancho x alto: cabeceras, pixeles sin
+// relleno y tabla de bandas
+long long tamanoMaximoQOI(int ancho, int alto, int canales, size_t tamCabeceras);
+
+// Comprueba sin decodificar que el archivo este entero: cabecera con esas
+// dimensiones, tabla de bandas al final del archivo y cada fila en una
+// banda dentro de los datos; 0 si es consistente
+int validarArchivoQOI(const char *ruta, int ancho, int alto, int canales);
+
+// Reconstruye el BMP original de un archivo QOI; 0 si fue bien
+int decodificarQOI(const char *entrada, const char *salida, FILE *log);
+
+#endif // QOI_H
@@ -0,0 +1,198 @@
+// topologia.c
+#define _GNU_SOURCE
+#include "topologia.h"
+#include <omp.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+MPI_Comm dividirPorNodo(MPI_Comm comm, char hostname[MAX_HOSTNAME]) {
+    gethostname(hostname, MAX_HOSTNAME);
+    hostname[MAX_HOSTNAME - 1] = '\0';
+    unsigned long host_hash = 5381;
+    for (int c = 0; hostname[c] != '\0'; c++)
+        host_hash = ((host_hash << 5) + host_hash) + hostname[c];
+
+    // El color de MPI_Comm_split tiene que ser no negativo
+    int rank;
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm nodo;
+    MPI_Comm_split(comm, (int)(host_hash & 0x7fffffff), rank, &nodo);
+    return nodo;
+}
+
+// Lee una lista de CPUs como "0-3,8,10-11" del archivo ruta
+static int leerListaCpus(const char *ruta, cpu_set_t *cpus) {
+    FILE *f = fopen(ruta, "r");
+    if (!f) return -1;
+    char texto[4096];
+    int ok = fgets(texto, sizeof(texto), f) != NULL;
+    fclose(f);
+    if (!ok) return -1;
+
+    CPU_ZERO(cpus);
+    int n = 0;
+    for (char *p = texto; *p && *p != '\n';) {
+        char *fin;
+        long desde = strtol(p, &fin, 10), hasta = desde;
+        if (fin == p) return -1;
+        if (*fin == '-') {
+            p = fin + 1;
+            hasta = strtol(p, &fin, 10);
+            if (fin == p) return -1;
+        }
+        for (long c = desde; c <= hasta && c < CPU_SETSIZE; c++) {
+            CPU_SET(c, cpus);
+            n++;
+        }
+        p = *fin == ',' ? fin + 1 : fin;
+    }
+    return n > 0 ? 0 : -1;
+}
+
+// CPUs que el cpuset del proceso permite (cgroup v1 o v2, Slurm, contenedores),
+// sin importar a que CPUs lo ato el lanzador. Si el cgroup no lo dice, los
+// CPUs en linea. El grupo hoja puede no tener el controlador, se sube hasta
+// encontrarlo.
+static void cpusPermitidos(cpu_set_t *permitidos) {
+    char linea[1024], ruta[1536], grupo[1024] = "";
+    int v1 = 0;
+    FILE *f = fopen("/proc/self/cgroup", "r");
+    if (f) {
+        while (fgets(linea, sizeof(linea), f)) {
+            char *controladores = strchr(linea, ':');
+            char *camino = controladores ? strchr(controladores + 1, ':') : NULL;
+            if (!camino) continue;
+            *camino++ = '\0';
+            camino[strcspn(camino, "\n")] = '\0';
+            if (strstr(controladores + 1, "cpuset")) {
+                snprintf(grupo, sizeof(grupo), "%s", camino);
+                v1 = 1;
+                break;
+            }
+            if (controladores[1] == '\0') snprintf(grupo, sizeof(grupo), "%s", camino); // "0::/..."
+        }
+        fclose(f);
+    }
+    while (grupo[0]) {
+        if (v1) {
+            snprintf(ruta, sizeof(ruta), "/sys/fs/cgroup/cpuset%s/cpuset.effective_cpus", grupo);
+            if (leerListaCpus(ruta, permitidos) == 0) return;
+            snprintf(ruta, sizeof(ruta), "/sys/fs/cgroup/cpuset%s/cpuset.cpus", grupo);
+        } else {
+            snprintf(ruta, sizeof(ruta), "/sys/fs/cgroup%s/cpuset.cpus.effective", grupo);
+        }
+        if (leerListaCpus(ruta, permitidos) == 0) return;
+        char *barra = strrchr(grupo, '/');
+        if (!barra) break;
+        if (barra == grupo) {
+            if (grupo[1] == '\0') break;
+            grupo[1] = '\0';
+        } else {
+            *barra = '\0';
+        }
+    }
+    CPU_ZERO(permitidos);
+    long enLinea = sysconf(_SC_NPROCESSORS_ONLN);
+    for (long c = 0; c < enLinea && c < CPU_SETSIZE; c++) CPU_SET(c, permitidos);
+}
+
+// El rank corre bajo un lanzador que sabe atar procesos (Open MPI, Hydra o
+// Slurm con --cpu-bind)
+static int bajoLanzador(void) {
+    return getenv("OMPI_COMM_WORLD_LOCAL_SIZE") || getenv("MPI_LOCALNRANKS") ||
+           getenv("SLURM_CPU_BIND_TYPE");
+}
+
+static int listaCpus(const cpu_set_t *cpus, int *lista) {
+    int n = 0;
+    for (int c = 0; c < CPU_SETSIZE; c++) {
+        if (CPU_ISSET(c, cpus)) lista[n++] = c;
+    }
+    return n;
+}
+
+void configurarTopologia(MPI_Comm nodo, int hilosPedidos, int atar, Topologia *t) {
+    memset(t, 0, sizeof(*t));
+    MPI_Comm_rank(nodo, &t->rankNodo);
+    MPI_Comm_size(nodo, &t->ranksNodo);
+
+    cpu_set_t propia, permitidos, union_, base;
+    cpusPermitidos(&permitidos);
+    if (sched_getaffinity(0, sizeof(propia), &propia) != 0) propia = permitidos;
+
+    // Un lanzador que ata cada rank (bind-to core o socket, lo que hace Open
+    // MPI por defecto) deja a cada rank una mascara mas angosta que su
+    // cpuset y cada rank quedaria con un hilo. Solo si todos los ranks del
+    // host estan asi se reparte lo que el cpuset permite en vez de la union
+    // de las mascaras; un cpuset angosto (Slurm, contenedor) sin atar no
+    // cuenta y nunca se sale de el.
+    cpu_set_t dentro, fuera;
+    CPU_AND(&dentro, &propia, &permitidos);
+    CPU_XOR(&fuera, &dentro, &permitidos);
+    int atadoPorLanzador = bajoLanzador() && CPU_EQUAL(&dentro, &propia) && CPU_COUNT(&fuera) > 0;
+    MPI_Allreduce(MPI_IN_PLACE, &atadoPorLanzador, 1, MPI_INT, MPI_LAND, nodo);
+    MPI_Allreduce(atadoPorLanzador ? &permitidos : &propia, &union_, sizeof(cpu_set_t), MPI_BYTE, MPI_BOR, nodo);
+
+    int lista[CPU_SETSIZE], n = listaCpus(&union_, lista);
+    t->cpusNodo = n;
+
+    // Bloque contiguo de este rank; si hay mas ranks que CPUs se comparten
+    int porRank = n / t->ranksNodo;
+    if (porRank < 1) porRank = 1;
+    int inicio = (int)((long long)n * t->rankNodo / t->ranksNodo);
+    if (inicio + porRank > n) inicio = n - porRank;
+    t->numCpus = porRank < MAX_CPUS_RANK ? porRank : MAX_CPUS_RANK;
+    for (int i = 0; i < t->numCpus; i++) t->cpus[i] = lista[inicio + i];
+
+    // Antes del primer parallel, asi los hilos de OpenMP heredan el bloque
+    // aunque no se aten. El bloque se recorta al cpuset propio (los ranks
+    // pueden tener cpusets distintos) y el rank se queda con la mascara que
+    // el kernel realmente aplico; si no aplica ninguna sigue con la del
+    // lanzador.
+    if (atadoPorLanzador) {
+        CPU_ZERO(&base);
+        for (int i = 0; i < t->numCpus; i++) CPU_SET(t->cpus[i], &base);
+        CPU_AND(&base, &base, &permitidos);
+        if (CPU_COUNT(&base) == 0 || sched_setaffinity(0, sizeof(base), &base) != 0 ||
+            sched_getaffinity(0, sizeof(base), &base) != 0) {
+            base = propia;
+        } else {
+            t->ampliada = 1;
+        }
+        int aplicada[CPU_SETSIZE];
+        int m = listaCpus(&base, aplicada);
+        t->numCpus = m < MAX_CPUS_RANK ? m : MAX_CPUS_RANK;
+        memcpy(t->cpus, aplicada, t->numCpus * sizeof(int));
+    }
+
+    t->hilos = t->numCpus;
+    const char *env = getenv("OMP_NUM_THREADS");
+    if (hilosPedidos > 0) t->hilos = hilosPedidos;
+    else if (env && atoi(env) > 0) t->hilos = atoi(env);
+    omp_set_num_threads(t->hilos);
+
+    // Con mas hilos que CPUs en el bloque, o si el runtime ya ata hilos
+    // (OMP_PROC_BIND / OMP_PLACES), no se toca la afinidad
+    if (!atar || t->hilos > t->numCpus || getenv("OMP_PROC_BIND") || getenv("OMP_PLACES")) return;
+
+    int fallos = 0;
+    #pragma omp parallel reduction(+:fallos)
+    {
+        cpu_set_t mascara;
+        CPU_ZERO(&mascara);
+        CPU_SET(t->cpus[omp_get_thread_num() % t->numCpus], &mascara);
+        fallos += sched_setaffinity(0, sizeof(mascara), &mascara) != 0;
+    }
+    t->atados = fallos == 0;
+}
+
+void atarHiloAlRank(const Topologia *t) {
+    if (!t || !t->atados) return;
+    cpu_set_t mascara;
+    CPU_ZERO(&mascara);
+    for (int i = 0; i < t->numCpus; i++) CPU_SET(t->cpus[i], &mascara);
+    sched_setaffinity(0, sizeof(mascara), &mascara);
+}
@@ -0,0 +1,39 @@
+// topologia.h
+#ifndef TOPOLOGIA_H
+#define TOPOLOGIA_H
+
+#include <mpi.h>
+
+#define MAX_HOSTNAME 256
+#define MAX_CPUS_RANK 1024
+#define MAX_HILOS_RANK 4096 // tope de --hilos
+
+// Reparto de los CPUs de un host entre sus ranks
+typedef struct {
+    int rankNodo, ranksNodo;
+    int cpusNodo;              // CPUs que pueden usar los ranks de este host
+    int hilos;                 // hilos OpenMP de este rank
+    int atados;                // 1 si cada hilo quedo fijo a un CPU
+    int ampliada;              // 1 si el lanzador ataba los ranks y se reparte su cpuset
+    int numCpus;               // CPUs del bloque de este rank
+    int cpus[MAX_CPUS_RANK];
+} Topologia;
+
+// Comunicador con los ranks del mismo host (hostname en hostname)
+MPI_Comm dividirPorNodo(MPI_Comm comm, char hostname[MAX_HOSTNAME]);
+
+// Cada rank toma un bloque contiguo de cpusNodo / ranksNodo CPUs de la union
+// de las afinidades de los ranks del host y usa un hilo por CPU, salvo que
+// hilosPedidos > 0 o OMP_NUM_THREADS lo fijen. Si un lanzador (Open MPI,
+// Hydra, Slurm --cpu-bind) ato cada rank a menos CPUs de los que su cpuset
+// permite, se reparten los CPUs del cpuset y el rank amplia su mascara a su
+// bloque dentro de el; los hilos salen de la mascara que el kernel aplico.
+// Con atar, el hilo t queda fijo al CPU t del bloque (bloques contiguos
+// suelen caer en un mismo socket / nodo NUMA). Llama a omp_set_num_threads.
+void configurarTopologia(MPI_Comm nodo, int hilosPedidos, int atar, Topologia *t);
+
+// Fija el hilo llamador (p. ej. los hilos de E/S del pipeline) al bloque de
+// CPUs del rank en lugar del CPU del hilo que lo creo
+void atarHiloAlRank(const Topologia *t);
+
+#endif // TOPOLOGIA_H